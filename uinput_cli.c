@@ -7,6 +7,9 @@
  *  - 多点：mt-down / mt-move / mt-up（slot-based）
  *  - 坐标映射 (--map W H)
  *  - 独占设备 (--grab)
+ *  - 多设备 (-d NAME=PATH 可重复，@NAME 指定目标，& 并行执行)
+ *  - 接触参数 (contact：压力、接触椭圆、方向、工具类型，可随手势渐变)
+ *  - 压力测试 (stress：可复现的随机点击、滑动和多指拖动)
  *
  * 示例：
  *   @code
@@ -17,375 +20,5314 @@
  *   @endcode
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <math.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 #include <getopt.h>
 #include <linux/input.h>
+#include <linux/uinput.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sched.h>
+#include <endian.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "uinput_proto.h"
 
 #define VERSION "1.0"
 
 #define RS_OK 	0
 #define RS_ERR -1
 
+#ifndef MT_TOOL_PALM
+#define MT_TOOL_PALM	0x02	/* 旧内核头文件没有手掌类型 */
+#endif
+#ifndef MT_TOOL_MAX
+#define MT_TOOL_MAX		0x0f
+#endif
+
 /* ------------------ 用户定义 ------------------ */
 
 #define dev_path	"/dev/input/event1"		/* 默认输入设备路径 */
-#define MAX_SLOTS	1		/* 最大支持多点触控数量 */
+#define uinput_path	"/dev/uinput"			/* uinput 控制节点 */
+#define input_dir	"/dev/input"			/* 设备发现扫描的目录 */
+#define UINPUT_NAME	"mca_uinput virtual touchscreen"	/* 虚拟设备名称 */
+#define UINPUT_SLOTS	10		/* 虚拟设备默认 slot 数 */
+#define UINPUT_SETTLE_MS	200	/* 虚拟设备创建后的等待时间（毫秒） */
+#define SLOTS_LIMIT	64		/* 运行时 slot 数上限 */
 #define SCREEN_W	1920	/* 屏幕宽度 */
 #define SCREEN_H	440		/* 屏幕高度 */
 #define LOGICAL_W	0		/* 逻辑宽度 */
 #define LOGICAL_H	0		/* 逻辑高度 */
+#define FRAME_EVENTS	(SLOTS_LIMIT * 9 + 8)	/* 帧缓冲容量：每个 slot 最多 9 个事件，另加按键和 SYN */
+#define WRITE_STALL_MS	100		/* 设备不可写时等待的最长时间（毫秒） */
+#define MEM_RING_EVENTS	4096	/* 内存后端环形缓冲的事件数 */
+#define MAX_ARGS		32		/* 单条文本命令最大参数个数 */
+#define LINE_MAX_LEN	1024	/* 单条文本命令最大长度 */
+#define ARENA_SIZE		8192	/* 每个会话的命令解析区大小（字节） */
+#define COORD_LIMIT		(1 << 20)	/* 命令中坐标参数的绝对值上限 */
+#define DURATION_MAX_MS	1000000		/* 命令中时长参数的上限（毫秒） */
+#define SPEED_MIN		0.01	/* --speed 的最小非 0 倍率 */
+#define SPEED_MAX		100.0	/* --speed 的最大倍率 */
+#define SERVE_CLIENTS	8		/* 守护模式最大客户端数 */
+#define SERVE_LISTENERS	4		/* 守护模式最大监听地址数 */
+#define SHM_RING_RECORDS	1024	/* 共享内存命令环的记录数（2 的幂） */
+#define DEVICES_MAX		8		/* -d 可指定的最大设备数 */
+#define DEV_NAME_LEN	32		/* 设备名称最大长度 */
+#define DEV_IDENT_LEN	80		/* 设备发现时读取的 name/phys 最大长度 */
+#define PROFILE_MAX		32		/* 设备档案文件的最大条目数 */
+#define PAR_LEAD_US		2000	/* 并行命令的公共起点距现在的时间（微秒） */
+#define TRAJ_MAX_FRAMES	100000	/* 单个轨迹的最大帧数 */
+#define FLING_DECAY		4.0		/* fling 轨迹的衰减系数 */
+#define NSWIPE_SPACING	80		/* nswipe 默认手指间距（UI 像素） */
+#define RECORD_BATCH	256		/* 录制时每次 read() 的事件数 */
+#define RECORD_BUF_SIZE	(64 * 1024)	/* 录制编码缓冲大小（每块） */
+#define RECORD_MAX_REC	24		/* 单个事件编码后的最大字节数 */
+#define LATENCY_FRAMES	1000	/* latency 默认注入帧数 */
+#define LATENCY_INTERVAL_MS	5	/* latency 默认帧间隔（毫秒） */
+#define LATENCY_DRAIN_MS	100		/* 注入结束后等待最后几帧送达的时间（毫秒） */
+#define LATENCY_BUCKETS	16		/* 延迟直方图桶数（按 2 的幂微秒分桶） */
+#define SPAN_RING	65536	/* --trace-json 环形缓冲的时间段数 */
+#define STRESS_RATE_HZ	200		/* stress 默认帧率 */
+#define RATE_MAX_HZ		1000000	/* --rate 和 stress 帧率的上限 */
+#define STRESS_FINGERS	5		/* stress 默认最多同时按下的手指数 */
+#define STRESS_SPAWN_PCT	30	/* stress 每帧新按下一指的概率（%） */
+#define BENCH_ITERATIONS	10000	/* bench 默认迭代次数 */
+#define BENCH_FINGERS	10		/* bench 多指测试的手指数上限 */
+#define BENCH_HOLD_MS	2		/* bench 保持时间误差测试的时长（毫秒） */
 
 /* ------------------ 全局状态 ------------------ */
 
 static const char *def_dev = dev_path;	/* 输入设备路径 */
-#if MAX_SLOTS > 1
-static int slot_tracking[MAX_SLOTS];	/* slot 对应的 tracking ID */
-static int next_tracking_id = 1;	/* 下一个 tracking ID */
-static int active_touches = 0;		/* 当前按下的触点数量 */
-#endif
+static int slots_opt = 0;			/* --slots 指定的 slot 数，0 表示按设备 */
+static int delta_opt = 1;			/* 省略未变化的绝对轴事件 */
+static double speed = 1.0;			/* 回放速度倍率，0 表示尽快 */
 /* UI 屏幕逻辑分辨率 */
 static int ui_w = LOGICAL_W;
 static int ui_h = LOGICAL_H;
+static int spin_us = 0;		/* 截止前忙等的时长（微秒） */
+static int rate_hz = 0;		/* 手势报告率（Hz），0 表示按步数 */
+static int clock_opt = CLOCK_REALTIME;	/* 事件时间戳的时钟，-1 表示不打时间戳 */
+static int clock_set = 0;		/* 是否显式给出了 --clock */
+static int rt_prio = 0;			/* --rt-prio：SCHED_FIFO 优先级，0 表示不切换 */
+static int cpu_opt = -1;		/* --cpu：绑定的 CPU，-1 表示不绑定 */
+static int mlock_opt = 0;		/* --mlock：锁定全部内存 */
+static const char *shm_name = NULL;	/* --shm：serve 的共享内存命令环名称 */
+static const char *profile_path = NULL;	/* --profile：设备档案文件 */
+static long long virt_ns = -1;	/* compile 时的虚拟时钟（纳秒），-1 表示使用真实时钟 */
+
+/* ------------------ 设备描述 ------------------ */
+
+/** 缓存的绝对轴索引 */
+enum {
+	AXIS_X,			/* ABS_X */
+	AXIS_Y,			/* ABS_Y */
+	AXIS_MT_X,		/* ABS_MT_POSITION_X */
+	AXIS_MT_Y,		/* ABS_MT_POSITION_Y */
+	AXIS_PRESSURE,	/* ABS_MT_PRESSURE */
+	AXIS_SLOT,		/* ABS_MT_SLOT */
+	AXIS_MAJOR,		/* ABS_MT_TOUCH_MAJOR */
+	AXIS_MINOR,		/* ABS_MT_TOUCH_MINOR */
+	AXIS_ORIENT,	/* ABS_MT_ORIENTATION */
+	AXIS_TOOL,		/* ABS_MT_TOOL_TYPE */
+	AXIS_COUNT
+};
+
+/** 单个绝对轴的缓存信息 */
+struct axis_info {
+	int valid;		/* EVIOCGABS 是否成功 */
+	int min;		/* 最小值 */
+	int max;		/* 最大值 */
+	int res;		/* 分辨率 */
+};
+
+/** 一个坐标方向的映射参数：dev = base + (ui * scale + 0x8000) >> 16 */
+struct axis_map {
+	int base;			/* 设备坐标起点 */
+	long long scale;	/* 16.16 定点缩放系数，0 表示不映射 */
+};
+
+#define MAP_SCALE_MAX	(1LL << 40)	/* 缩放系数上限，保证 COORD_LIMIT 倍不溢出 */
+
+#define MT_CODE_FIRST	ABS_MT_TOUCH_MAJOR	/* 第一个按 slot 保存的 MT 轴 */
+#define MT_CODE_COUNT	(ABS_MT_TOOL_Y - ABS_MT_TOUCH_MAJOR + 1)
+#define SHADOW_UNKNOWN	INT_MIN		/* 影子值未知 */
+
+/** 单个 slot 的触点状态 */
+struct slot_state {
+	int tracking_id;	/* tracking ID，0 表示未按下 */
+	int x;				/* 最近一次的设备坐标 X */
+	int y;				/* 最近一次的设备坐标 Y */
+	int dirty;			/* 已更新但尚未发出的轴（SLOT_DIRTY_*） */
+	int mt_last[MT_CODE_COUNT];	/* 各 MT 轴最近一次发出的值 */
+};
+
+#define SLOT_DIRTY_X	0x1		/* x 待发出 */
+#define SLOT_DIRTY_Y	0x2		/* y 待发出 */
+
+/** mt_frame() 的一项更新（UI 坐标） */
+struct slot_update {
+	int slot;	/* slot 编号 */
+	int x;		/* UI 屏幕 X 坐标 */
+	int y;		/* UI 屏幕 Y 坐标 */
+};
+
+/** contact 命令设置的接触参数 */
+enum {
+	CT_PRESSURE,	/* 压力：0..100（% 量程） */
+	CT_MAJOR,		/* 接触椭圆长轴：UI 像素 */
+	CT_MINOR,		/* 接触椭圆短轴：UI 像素 */
+	CT_ORIENT,		/* 方向：-90..90 度 */
+	CT_TOOL,		/* 工具类型：MT_TOOL_* */
+	CT_COUNT
+};
 
-/* ------------------ 工具函数 ------------------ */
+/** 按下和手势过程中附带的接触轴，滑动时从 start 线性过渡到 end */
+struct contact {
+	int set;			/* 已设置的参数（1 << CT_*） */
+	int start[CT_COUNT];	/* 起始值（contact 命令的单位） */
+	int end[CT_COUNT];		/* 结束值 */
+};
+
+struct touch_dev;
+
+/** 输出后端：设备打开时选定，帧最终经由它写出 */
+struct emitter {
+	const char *name;	/* 后端名称 */
+	/* 完整写出一批事件，RS_OK 成功，RS_ERR 失败 */
+	int (*write)(struct touch_dev *td, const struct input_event *ev, int count);
+	/* 释放后端资源，可为 NULL */
+	void (*close)(struct touch_dev *td);
+};
+
+/** 打开的触摸设备 */
+struct touch_dev {
+	int fd;								/* 设备文件描述符，内存后端为 -1 */
+	struct axis_info axes[AXIS_COUNT];	/* open_dev() 时读取的轴信息 */
+	struct axis_map map_x;				/* X 方向映射 */
+	struct axis_map map_y;				/* Y 方向映射 */
+	struct input_event frame[FRAME_EVENTS];	/* 帧缓冲 */
+	int frame_len;						/* 已暂存事件数 */
+	int frame_done;						/* 其中以 SYN_REPORT 结束的完整帧的事件数 */
+	int frame_hold;						/* 非 0 时 syn() 不立即提交 */
+	int frame_err;						/* 嵌套批次中途出错，最外层结束时整批丢弃 */
+	struct timeval frame_time;			/* 当前帧的时间戳 */
+	int frame_stamped;					/* 当前帧是否已取时间戳 */
+	int stamp_out;						/* 写出的时间戳会被读到（文件、管道、套接字、mem:） */
+	int is_uinput;						/* 是否为 /dev/uinput 虚拟设备 */
+	struct slot_state *slots;			/* slot 状态表 */
+	int nslots;							/* slot 数，由 ABS_MT_SLOT 最大值决定 */
+	int active_touches;					/* 当前按下的触点数量 */
+	int abs_last[ABS_CNT];				/* 各绝对轴最近一次发出的值 */
+	int cur_slot;						/* 最近一次发出的 ABS_MT_SLOT，-1 未知 */
+	int next_tracking_id;				/* 下一个 tracking ID */
+	const struct emitter *emit;			/* 输出后端 */
+	void *emit_ctx;						/* 后端私有数据 */
+	char name[DEV_NAME_LEN];			/* 多设备时 @NAME 使用的名称 */
+	struct contact contact;				/* 附带的接触轴 */
+};
+
+/* ------------------ 统计 ------------------ */
+
+/*
+ * 热路径上只做计数器自增（写入耗时和睡眠超时另读两次单调时钟），--stats
+ * 时退出前输出到 stderr，守护模式下收到 SIGUSR1 时也会输出当前值。
+ * --trace-json FILE 另外把写入、睡眠和手势的时间段记录到固定大小的环形
+ * 缓冲（满后覆盖最旧的记录），退出时写成 Chrome trace（chrome://tracing）
+ * 格式，用来查看某次手势变慢时时间花在了哪里。
+ */
+
+/** 热路径计数器 */
+struct stats {
+	unsigned long long syscalls;	/* write() 调用次数 */
+	unsigned long long frames;		/* 提交的帧缓冲/批次数 */
+	unsigned long long events;		/* 写入的事件数 */
+	unsigned long long bytes;		/* 写入的字节数 */
+	unsigned long long eagain;		/* write() 返回 EAGAIN 的次数 */
+	unsigned long long ioctls;		/* 设备 ioctl 次数 */
+	unsigned long long maps;		/* 坐标映射次数 */
+	unsigned long long sleeps;		/* sleep_until()/msleep() 次数 */
+	unsigned long long missed;		/* 错过的帧截止时间 */
+	long long write_ns;				/* write() 累计耗时（纳秒） */
+	long long oversleep_ns;			/* 睡眠超过截止时间的累计值（纳秒） */
+};
+
+/** 环形缓冲中的一个时间段 */
+struct span {
+	const char *name;	/* 名称（静态字符串） */
+	int tid;			/* 线程号 */
+	long long ts;		/* 开始时间（单调时钟，纳秒） */
+	long long dur;		/* 持续时间（纳秒） */
+};
+
+static __thread struct stats stats;	/* 计数器（每线程一份，并行命令结束后合并） */
+static __thread int span_tid = 0;	/* 时间段所属的线程号（并行命令中为设备序号 + 1） */
+static int stats_opt = 0;			/* --stats：退出时输出计数器 */
+static const char *span_path = NULL;	/* --trace-json 输出文件 */
+static struct span *span_ring = NULL;	/* 时间段环形缓冲，NULL 表示不记录 */
+static unsigned long span_count = 0;	/* 已记录的时间段总数 */
+
+/* 计数的设备 ioctl */
+#define dev_ioctl(fd, ...)	(stats.ioctls++, ioctl((fd), __VA_ARGS__))
 
 /**
- * @brief 打开输入设备
- * @param path 输入设备路径（如 /dev/input/eventX）
- * @return 成功返回设备文件描述符，失败返回 RS_ERR
+ * @brief 读取单调时钟
+ * @return 当前时间（纳秒）
  */
-static int open_dev(const char *path) {
-    int fd = open(path, O_WRONLY | O_NONBLOCK);
-    if (fd < 0) fprintf(stderr, "open %s failed: %s\n", path, strerror(errno));
-    return fd >= 0 ? fd : RS_ERR;
+static long long mono_ns(void) {
+	struct timespec ts;
+	if (virt_ns >= 0)
+		return virt_ns;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
 /**
- * @brief 向输入设备写入一个事件
- * @param fd 设备文件描述符
+ * @brief 记录一个时间段
+ * @param name 名称（静态字符串）
+ * @param start 开始时间（纳秒）
+ * @param end 结束时间（纳秒）
+ */
+static inline void span_record(const char *name, long long start, long long end) {
+	if (!span_ring)
+		return;
+	struct span *sp = &span_ring[__sync_fetch_and_add(&span_count, 1) % SPAN_RING];
+	sp->name = name;
+	sp->tid = span_tid;
+	sp->ts = start;
+	sp->dur = end - start;
+}
+
+/**
+ * @brief 输出计数器
+ * @param fp 输出流
+ */
+static void stats_dump(FILE *fp) {
+	fprintf(fp,
+			"stats: syscalls %llu, frames %llu, events %llu, bytes %llu, eagain %llu, ioctls %llu\n"
+			"stats: maps %llu, sleeps %llu, missed deadlines %llu\n"
+			"stats: write time %lld us, sleep overshoot %lld us\n",
+			stats.syscalls, stats.frames, stats.events, stats.bytes, stats.eagain, stats.ioctls,
+			stats.maps, stats.sleeps, stats.missed,
+			stats.write_ns / 1000, stats.oversleep_ns / 1000);
+}
+
+/**
+ * @brief 把一份计数器累加到当前线程
+ * @param st 其他线程的计数器
+ */
+static void stats_merge(const struct stats *st) {
+	stats.syscalls += st->syscalls;
+	stats.frames += st->frames;
+	stats.events += st->events;
+	stats.bytes += st->bytes;
+	stats.eagain += st->eagain;
+	stats.ioctls += st->ioctls;
+	stats.maps += st->maps;
+	stats.sleeps += st->sleeps;
+	stats.missed += st->missed;
+	stats.write_ns += st->write_ns;
+	stats.oversleep_ns += st->oversleep_ns;
+}
+
+/**
+ * @brief 以 Chrome trace JSON 格式写出环形缓冲
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int span_dump(void) {
+	unsigned long first = span_count > SPAN_RING ? span_count - SPAN_RING : 0;
+	FILE *fp;
+
+	if (!span_ring)
+		return RS_OK;
+	fp = fopen(span_path, "w");
+	if (!fp) {
+		fprintf(stderr, "open %s failed: %s\n", span_path, strerror(errno));
+		return RS_ERR;
+	}
+	fprintf(fp, "{\"traceEvents\":[");
+	for (unsigned long i = first; i < span_count; i++) {
+		const struct span *sp = &span_ring[i % SPAN_RING];
+		fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+				"\"ts\":%lld.%03lld,\"dur\":%lld.%03lld}",
+				i == first ? "" : ",", sp->name, sp->tid,
+				sp->ts / 1000, sp->ts % 1000, sp->dur / 1000, sp->dur % 1000);
+	}
+	fprintf(fp, "\n]}\n");
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "write %s failed\n", span_path);
+		return RS_ERR;
+	}
+	return RS_OK;
+}
+
+/* ------------------ 增量抑制 ------------------ */
+
+/*
+ * 设备保存每个绝对轴最近一次发出的值（MT 轴按 slot 分别保存）以及当前的
+ * ABS_MT_SLOT，值未变化的 EV_ABS 事件不再写出。这要求本工具是该设备
+ * 唯一的事件来源；真实手指同时在操作时用 --no-delta 关闭。
+ * 写入失败后无法确定内核已收到哪些事件，影子值全部作废。
+ */
+
+/**
+ * @brief 作废全部影子值
+ * @param td 触摸设备
+ */
+static void delta_reset(struct touch_dev *td) {
+	for (int i = 0; i < ABS_CNT; i++)
+		td->abs_last[i] = SHADOW_UNKNOWN;
+	td->cur_slot = -1;
+	for (int s = 0; s < td->nslots; s++) {
+		for (int i = 0; i < MT_CODE_COUNT; i++)
+			td->slots[s].mt_last[i] = SHADOW_UNKNOWN;
+	}
+}
+
+/**
+ * @brief 比较并更新一个影子值
+ * @param last 影子值
+ * @param value 新值
+ * @return 1 需要发出，0 与上次相同可省略
+ */
+static inline int shadow_update(int *last, int value) {
+	if (delta_opt && *last == value)
+		return 0;
+	*last = value;
+	return 1;
+}
+
+/**
+ * @brief 判断一个绝对轴事件是否需要发出，并更新影子值
+ * @param td 触摸设备
+ * @param code 轴代码
+ * @param value 轴值
+ * @return 1 需要发出，0 可省略
+ */
+static int abs_changed(struct touch_dev *td, __u16 code, int value) {
+	if (code == ABS_MT_SLOT) {
+		if (delta_opt && td->cur_slot == value)
+			return 0;
+		td->cur_slot = value;
+		return 1;
+	}
+	if (code >= MT_CODE_FIRST && code < MT_CODE_FIRST + MT_CODE_COUNT) {
+		/* 当前 slot 未知时（如 type A 协议）不做抑制 */
+		if (td->cur_slot < 0 || td->cur_slot >= td->nslots)
+			return 1;
+		return shadow_update(&td->slots[td->cur_slot].mt_last[code - MT_CODE_FIRST], value);
+	}
+	return code < ABS_CNT ? shadow_update(&td->abs_last[code], value) : 1;
+}
+
+/* ------------------ 输出后端 ------------------ */
+
+/*
+ * 帧缓冲和预计算轨迹最终都经 write_frames() 交给设备的输出后端：
+ *
+ *   evdev   写入 /dev/input/eventX 节点
+ *   uinput  写入 /dev/uinput 创建的虚拟设备，关闭时销毁设备
+ *   socket  -d sock:PATH，把原始 input_event 流转发到 Unix 域套接字
+ *   mem     -d mem:，写入进程内的环形缓冲，不经过内核，用于单独测量
+ *           轨迹生成和帧组装的开销（如 mca_uinput_bench -d mem: bench）
+ *   capture compile 时临时替换设备的后端，捕获事件和截止时间
+ */
+
+/**
+ * @brief 文件描述符后端的写入：处理短写、EINTR 和 EAGAIN
+ * @param td 触摸设备
+ * @param ev 事件数组
+ * @param count 事件个数
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int fd_write(struct touch_dev *td, const struct input_event *ev, int count) {
+	const char *p = (const char *)ev;
+	size_t left = count * sizeof(struct input_event);
+	long long stall = 0;	/* 开始受阻的时刻，0 表示未受阻 */
+
+	while (left > 0) {
+		ssize_t n = write(td->fd, p, left);
+		stats.syscalls++;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				/* 读端暂时跟不上：等到可写后重交剩余部分，受阻总时长有上限 */
+				long long now = mono_ns();
+				int left_ms;
+				stats.eagain++;
+				if (!stall)
+					stall = now;
+				left_ms = WRITE_STALL_MS - (int)((now - stall) / 1000000);
+				if (left_ms > 0) {
+					struct pollfd pfd = { td->fd, POLLOUT, 0 };
+					if (poll(&pfd, 1, left_ms) >= 0 || errno == EINTR)
+						continue;
+				}
+				fprintf(stderr, "write_event failed: device not writable for %d ms\n",
+						WRITE_STALL_MS);
+				return RS_ERR;
+			}
+			fprintf(stderr, "write_event failed: %s\n", strerror(errno));
+			return RS_ERR;
+		}
+		if (n == 0) {
+			fprintf(stderr, "write_event failed: short write\n");
+			return RS_ERR;
+		}
+		/* 短写：内核只接收了部分事件，继续提交剩余部分 */
+		p += n;
+		left -= n;
+		stats.bytes += n;
+	}
+	return RS_OK;
+}
+
+/**
+ * @brief 关闭文件描述符后端
+ * @param td 触摸设备
+ */
+static void fd_close(struct touch_dev *td) {
+	close(td->fd);
+	td->fd = -1;
+}
+
+/**
+ * @brief 关闭 uinput 后端，同时销毁虚拟设备
+ * @param td 触摸设备
+ */
+static void uinput_close(struct touch_dev *td) {
+	dev_ioctl(td->fd, UI_DEV_DESTROY);
+	fd_close(td);
+}
+
+/** 内存后端的环形缓冲 */
+struct mem_ring {
+	struct input_event ev[MEM_RING_EVENTS];	/* 最近写出的事件 */
+	unsigned long long total;				/* 写出的事件总数 */
+};
+
+/**
+ * @brief 内存后端的写入：复制到环形缓冲，满后覆盖最旧的事件
+ * @param td 触摸设备
+ * @param ev 事件数组
+ * @param count 事件个数
+ * @return RS_OK
+ */
+static int mem_write(struct touch_dev *td, const struct input_event *ev, int count) {
+	struct mem_ring *r = td->emit_ctx;
+
+	for (int i = 0; i < count; i++)
+		r->ev[r->total++ % MEM_RING_EVENTS] = ev[i];
+	stats.bytes += count * sizeof(*ev);
+	return RS_OK;
+}
+
+/**
+ * @brief 关闭内存后端
+ * @param td 触摸设备
+ */
+static void mem_close(struct touch_dev *td) {
+	free(td->emit_ctx);
+	td->emit_ctx = NULL;
+}
+
+/** 编译文件中的一批帧 */
+struct compiled_frame {
+	int64_t offset_ns;		/* 相对起点的截止时间（纳秒） */
+	uint32_t first;			/* 第一个事件的下标 */
+	uint32_t count;			/* 事件个数 */
+};
+
+/** compile 时捕获的输出 */
+struct capture {
+	struct compiled_frame *frames;	/* 批次表 */
+	int nframes;					/* 批次数 */
+	int frames_cap;					/* 批次表容量 */
+	struct input_event *ev;			/* 事件表 */
+	int nev;						/* 事件数 */
+	int ev_cap;						/* 事件表容量 */
+};
+
+/**
+ * @brief compile 后端的写入：追加到捕获输出，截止时间取虚拟时钟
+ * @param td 触摸设备
+ * @param ev 事件数组
+ * @param count 事件个数
+ * @return RS_OK 成功，RS_ERR 内存不足
+ */
+static int capture_write(struct touch_dev *td, const struct input_event *ev, int count) {
+	struct capture *c = td->emit_ctx;
+
+	if (c->nframes == c->frames_cap) {
+		int n = c->frames_cap ? c->frames_cap * 2 : 256;
+		void *p = realloc(c->frames, sizeof(*c->frames) * n);
+		if (!p)
+			goto oom;
+		c->frames = p;
+		c->frames_cap = n;
+	}
+	if (c->nev + count > c->ev_cap) {
+		int n = c->ev_cap ? c->ev_cap : 1024;
+		while (n < c->nev + count)
+			n *= 2;
+		void *p = realloc(c->ev, sizeof(*c->ev) * n);
+		if (!p)
+			goto oom;
+		c->ev = p;
+		c->ev_cap = n;
+	}
+	struct compiled_frame *f = &c->frames[c->nframes++];
+	f->offset_ns = virt_ns;
+	f->first = c->nev;
+	f->count = count;
+	memcpy(c->ev + c->nev, ev, sizeof(*ev) * count);
+	c->nev += count;
+	return RS_OK;
+
+oom:
+	fprintf(stderr, "out of memory\n");
+	return RS_ERR;
+}
+
+static const struct emitter emit_evdev = { "evdev", fd_write, fd_close };
+static const struct emitter emit_uinput = { "uinput", fd_write, uinput_close };
+static const struct emitter emit_socket = { "socket", fd_write, fd_close };
+static const struct emitter emit_mem = { "mem", mem_write, mem_close };
+static const struct emitter emit_capture = { "capture", capture_write, NULL };
+
+/* ------------------ 帧缓冲 ------------------ */
+
+/*
+ * write_event() 只把事件暂存到设备的帧缓冲，直到 syn() 结束一帧时才用一次
+ * write() 整帧提交，这样读端不会看到半帧，每帧也只花一次系统调用。
+ * burst_begin()/burst_end() 之间的多个帧会连续累积，最后一次性提交；批次
+ * 中途缓冲写满时只提前提交已完整结束的帧，不把一帧拆成两次 write()。
+ */
+
+/**
+ * @brief 把一组连续事件完整写入设备
+ * @param td 触摸设备
+ * @param ev 事件数组
+ * @param count 事件个数
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int write_frames(struct touch_dev *td, const struct input_event *ev, int count) {
+	long long t0 = mono_ns();
+	stats.frames++;
+	stats.events += count;
+	if (td->emit->write(td, ev, count) == RS_ERR)
+		return RS_ERR;
+	long long t1 = mono_ns();
+	stats.write_ns += t1 - t0;
+	span_record("write", t0, t1);
+	return RS_OK;
+}
+
+/**
+ * @brief 提交帧缓冲中的全部事件
+ * @param td 触摸设备
+ * @return RS_OK 成功，RS_ERR 失败（缓冲被丢弃）
+ */
+static int frame_flush(struct touch_dev *td) {
+	int n = td->frame_len;
+
+	td->frame_len = 0;
+	td->frame_done = 0;
+	if (write_frames(td, td->frame, n) == RS_ERR) {
+		delta_reset(td);
+		return RS_ERR;
+	}
+	return RS_OK;
+}
+
+/**
+ * @brief 开始一个突发批次，之后的帧累积到 burst_end() 再提交
+ * @param td 触摸设备
+ */
+static void burst_begin(struct touch_dev *td) {
+	td->frame_hold++;
+}
+
+/**
+ * @brief 结束突发批次
+ * @param td 触摸设备
+ * 嵌套时内层的丢弃会记下来，外层即使要求提交，最外层结束时也整批丢弃。
+ * @param commit 非 0 提交累积的帧，0 丢弃（批次中途出错时使用）
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int burst_end(struct touch_dev *td, int commit) {
+	if (!commit)
+		td->frame_err = 1;
+	if (td->frame_hold > 0 && --td->frame_hold > 0)
+		return commit ? RS_OK : RS_ERR;
+	if (td->frame_err) {
+		/* 丢弃的事件已经推进了影子值 */
+		td->frame_err = 0;
+		td->frame_len = 0;
+		td->frame_done = 0;
+		delta_reset(td);
+		return RS_ERR;
+	}
+	return td->frame_len > 0 ? frame_flush(td) : RS_OK;
+}
+
+/**
+ * @brief 帧缓冲写满时腾出空间
+ *
+ * 只提交已完整结束的帧，未结束的部分移到缓冲开头继续累积；单帧就超过
+ * 缓冲容量时整帧丢弃并报错，不拆开写出。
+ * @param td 触摸设备
+ * @return RS_OK 成功，RS_ERR 失败（缓冲被丢弃）
+ */
+static int frame_spill(struct touch_dev *td) {
+	int done = td->frame_done;
+	int rest = td->frame_len - done;
+
+	if (done == 0) {
+		fprintf(stderr, "frame exceeds %d events, dropped\n", FRAME_EVENTS);
+		td->frame_len = 0;
+		delta_reset(td);
+		return RS_ERR;
+	}
+	td->frame_len = done;
+	if (frame_flush(td) == RS_ERR)
+		return RS_ERR;
+	memmove(td->frame, td->frame + done, sizeof(td->frame[0]) * rest);
+	td->frame_len = rest;
+	return RS_OK;
+}
+
+/**
+ * @brief 判断写出的事件是否需要时间戳
+ *
+ * evdev 和 uinput 的 write() 都由内核重新打时间戳，写入的值只对直接读取
+ * 输出的工具（-d 指向普通文件、管道、sock: 或 mem:）有意义；设备节点只在
+ * 显式给出 --clock 时才打，none 时一律不打，省去取时间的开销。
+ * @param td 触摸设备
+ * @return 需要时为 1
+ */
+static inline int stamp_wanted(const struct touch_dev *td) {
+	return clock_opt >= 0 && (td->stamp_out || clock_set);
+}
+
+/**
+ * @brief 按 --clock 取当前帧的时间戳
+ * @param td 触摸设备
+ * @see stamp_wanted
+ */
+static void frame_stamp(struct touch_dev *td) {
+	struct timespec ts;
+
+	if (!stamp_wanted(td)) {
+		memset(&td->frame_time, 0, sizeof(td->frame_time));
+		return;
+	}
+	clock_gettime(clock_opt, &ts);
+	td->frame_time.tv_sec = ts.tv_sec;
+	td->frame_time.tv_usec = ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 按 --clock 给即将写出的预计算事件打时间戳
+ *
+ * 预计算帧表和编译文件里的时间戳为 0，写出前才取时间，与帧缓冲一样一次
+ * 写出共用一个时间戳；不需要时间戳时保持为 0。
+ * @param td 触摸设备
+ * @param ev 事件数组
+ * @param count 事件个数
+ */
+static void frames_stamp(const struct touch_dev *td, struct input_event *ev, int count) {
+	struct timespec ts;
+	struct timeval tv;
+
+	if (!stamp_wanted(td))
+		return;
+	clock_gettime(clock_opt, &ts);
+	tv.tv_sec = ts.tv_sec;
+	tv.tv_usec = ts.tv_nsec / 1000;
+	for (int i = 0; i < count; i++)
+		ev[i].time = tv;
+}
+
+/**
+ * @brief 向输入设备写入一个事件（暂存到帧缓冲）
+ * @param td 触摸设备
  * @param type 事件类型
  * @param code 事件代码
  * @param value 事件值
  * @return RS_OK 成功，RS_ERR 失败
  */
-static int write_event(int fd, __u16 type, __u16 code, int value) {
-    struct input_event ev;
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    ev.time = tv;
-    ev.type = type;
-    ev.code = code;
-    ev.value = value;
-    if (write(fd, &ev, sizeof(ev)) != sizeof(ev)) {
-        fprintf(stderr, "write_event failed: %s\n", strerror(errno));
-        return RS_ERR;
-    }
+static int write_event(struct touch_dev *td, __u16 type, __u16 code, int value) {
+    struct input_event *ev;
+
+	if (type == EV_ABS && !abs_changed(td, code, value))
+		return RS_OK;
+
+	/* 缓冲已满时先提交已完整结束的帧 */
+	if (td->frame_len == FRAME_EVENTS && frame_spill(td) == RS_ERR)
+		return RS_ERR;
+
+	/* 一帧只取一次时间，帧内事件共用同一时间戳 */
+	if (!td->frame_stamped) {
+		frame_stamp(td);
+		td->frame_stamped = 1;
+	}
+	ev = &td->frame[td->frame_len++];
+    ev->time = td->frame_time;
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
     return RS_OK;
 }
 
 /**
- * @brief 发送 SYN_REPORT 事件
- * @param fd 设备文件描述符
+ * @brief 发送 SYN_REPORT 事件并提交整帧
+ * @param td 触摸设备
  * @return RS_OK 成功，RS_ERR 失败
  */
-static int syn(int fd) {
-	return write_event(fd, EV_SYN, SYN_REPORT, 0);
+static int syn(struct touch_dev *td) {
+	int ret = write_event(td, EV_SYN, SYN_REPORT, 0);
+	td->frame_stamped = 0;
+	if (ret == RS_ERR)
+		return RS_ERR;
+	td->frame_done = td->frame_len;
+	return td->frame_hold ? RS_OK : frame_flush(td);
 }
 
 /**
  * @brief 发送 SYN_MT_REPORT 事件
- * @param fd 设备文件描述符
+ * @param td 触摸设备
  * @return RS_OK 成功，RS_ERR 失败
  */
-static int syn_mt(int fd) {
-	return write_event(fd, EV_SYN, SYN_MT_REPORT, 0);
+static int syn_mt(struct touch_dev *td) {
+	return write_event(td, EV_SYN, SYN_MT_REPORT, 0);
+}
+
+/**
+ * @brief 填充一个事件
+ * @param ev 目标事件
+ * @param type 事件类型
+ * @param code 事件代码
+ * @param value 事件值
+ */
+static inline void ev_set(struct input_event *ev, __u16 type, __u16 code, int value) {
+	memset(&ev->time, 0, sizeof(ev->time));
+	ev->type = type;
+	ev->code = code;
+	ev->value = value;
+}
+
+/* ------------------ 定时 ------------------ */
+
+/*
+ * 手势按 CLOCK_MONOTONIC 上的绝对截止时间调度：每一步的时刻都由起点直接
+ * 算出，而不是累加固定的 sleep，因此整数截断和系统调用耗时不会累积成漂移。
+ * spin_us > 0 时先睡到截止前 spin_us 微秒，剩余部分忙等，以降低唤醒抖动。
+ */
+
+/**
+ * @brief 毫秒延迟
+ */
+static void msleep(int ms) {
+	if(ms > 0 && virt_ns >= 0) {
+		virt_ns += ms * 1000000LL;
+	}
+	else if(ms > 0) {
+		long long t0 = mono_ns();
+		usleep(ms*1000);
+		long long t1 = mono_ns();
+		stats.sleeps++;
+		if (t1 - t0 > ms * 1000000LL)
+			stats.oversleep_ns += t1 - t0 - ms * 1000000LL;
+		span_record("sleep", t0, t1);
+	}
+}
+
+/**
+ * @brief 等待到指定的绝对时刻
+ * @param deadline 截止时间（单调时钟，纳秒）
+ */
+static void sleep_until(long long deadline) {
+	long long wake = deadline - (long long)spin_us * 1000;
+	long long t0 = mono_ns();
+	struct timespec ts;
+
+	/* compile 时不真正等待，只把虚拟时钟推进到截止时间 */
+	if (virt_ns >= 0) {
+		if (deadline > virt_ns)
+			virt_ns = deadline;
+		return;
+	}
+
+	if (wake > t0) {
+		ts.tv_sec = wake / 1000000000LL;
+		ts.tv_nsec = wake % 1000000000LL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+	}
+	while (spin_us > 0 && mono_ns() < deadline)
+		;
+	long long now = mono_ns();
+	stats.sleeps++;
+	if (now > deadline)
+		stats.oversleep_ns += now - deadline;
+	span_record("sleep", t0, now);
+}
+
+/**
+ * @brief qsort 比较函数（long long 升序）
+ */
+static int latency_cmp(const void *a, const void *b) {
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * ticker 把 duration 均分为 frames 个帧周期，逐帧给出截止时间。
+ * 周期的余数用整数累加器摊到各帧上，循环中没有 64 位除法。
+ * 落后超过一个周期时，ticker_next() 一次返回所有已到期的帧，调用者把它们
+ * 合并为一次 write() 追上进度，这些帧计入 missed，手势总时长保持不变而
+ * 不是被拉长。帧只写有变化的轴，所以到期帧必须全部送达而不能丢弃。
+ */
+
+/** 手势帧调度器 */
+struct ticker {
+	long long deadline;	/* 当前帧的截止时间（纳秒） */
+	long long period;	/* 帧周期的整数部分（纳秒） */
+	int rem;			/* 帧周期的余数部分 */
+	int acc;			/* 余数累加器 */
+	int frames;			/* 总帧数 */
+	int index;			/* 已调度到的帧号 */
+	int missed;			/* 错过截止时间的帧数 */
+};
+
+/**
+ * @brief 以当前时刻为起点启动调度器
+ * @param tk 调度器
+ * @param duration_ms 总时长（毫秒）
+ * @param frames 总帧数（>= 1）
+ */
+static void ticker_start(struct ticker *tk, int duration_ms, int frames) {
+	long long total = duration_ms * 1000000LL;
+
+	tk->deadline = mono_ns();
+	tk->period = total / frames;
+	tk->rem = (int)(total % frames);
+	tk->acc = 0;
+	tk->frames = frames;
+	tk->index = 0;
+	tk->missed = 0;
+}
+
+/**
+ * @brief 推进一帧的截止时间
+ * @param tk 调度器
+ */
+static inline void ticker_advance(struct ticker *tk) {
+	tk->index++;
+	tk->deadline += tk->period;
+	tk->acc += tk->rem;
+	if (tk->acc >= tk->frames) {
+		tk->acc -= tk->frames;
+		tk->deadline++;
+	}
+}
+
+/**
+ * @brief 等待下一帧的截止时间
+ * @param tk 调度器
+ * @return 现在应发出的帧数（>= 1），大于 1 表示落后，多出的帧计入 missed
+ */
+static int ticker_next(struct ticker *tk) {
+	int due = 1;
+
+	ticker_advance(tk);
+	if (tk->index < tk->frames && mono_ns() >= tk->deadline + tk->period) {
+		long long now = mono_ns();
+		while (tk->index < tk->frames && now >= tk->deadline + tk->period) {
+			ticker_advance(tk);
+			due++;
+		}
+		tk->missed += due - 1;
+		stats.missed += due - 1;
+	}
+	sleep_until(tk->deadline);
+	return due;
+}
+
+/**
+ * @brief 报告错过截止时间的帧
+ * @param tk 调度器
+ * @param what 手势名称
+ */
+static void ticker_report(const struct ticker *tk, const char *what) {
+	if (tk->missed > 0)
+		fprintf(stderr, "%s: missed %d of %d frame deadlines\n",
+				what, tk->missed, tk->frames);
+}
+
+/*
+ * --report 时 traj_play() 记下每帧的截止时间和实际写完的时刻，手势结束后
+ * 在 stderr 输出一行汇总：
+ *
+ *   report @0 swipe: frames 20 duration_err_us 35 jitter_us min 12 p50 48 p99 210 max 260 missed 0 syscalls 20
+ *
+ * jitter 为实际写完时刻减截止时间，合并写出的落后帧按各自的截止时间计算。
+ * 样本缓冲按 TRAJ_MAX_FRAMES 预先分配（每个执行线程一份），定时循环中
+ * 只多读一次时钟，不分配内存。
+ */
+
+/** 一帧的时间样本 */
+struct frame_sample {
+	long long sched;	/* 截止时间（单调时钟，纳秒） */
+	long long actual;	/* 实际写完的时刻 */
+};
+
+static int report_opt = 0;			/* --report：输出每个手势的定时汇总 */
+static __thread struct frame_sample *report_buf = NULL;	/* 样本缓冲（TRAJ_MAX_FRAMES 项） */
+static __thread int report_len = 0;	/* 当前手势已记录的样本数 */
+
+/**
+ * @brief 为当前线程分配样本缓冲
+ * @return RS_OK 成功或不需要，RS_ERR 内存不足
+ */
+static int report_alloc(void) {
+	if (!report_opt || report_buf)
+		return RS_OK;
+	report_buf = malloc(sizeof(*report_buf) * TRAJ_MAX_FRAMES);
+	if (!report_buf) {
+		fprintf(stderr, "out of memory\n");
+		return RS_ERR;
+	}
+	return RS_OK;
+}
+
+/**
+ * @brief 记录一次写出覆盖的各帧样本
+ * @param tk 调度器（deadline 为最后一个到期帧的截止时间）
+ * @param due 本次写出的帧数
+ * @param actual 写完的时刻
+ */
+static inline void report_add(const struct ticker *tk, int due, long long actual) {
+	for (int j = due - 1; j >= 0 && report_len < TRAJ_MAX_FRAMES; j--) {
+		report_buf[report_len].sched = tk->deadline - j * tk->period;
+		report_buf[report_len].actual = actual;
+		report_len++;
+	}
 }
 
 /**
- * @brief 毫秒延迟
+ * @brief 输出一个手势的定时汇总
+ * @param td 触摸设备（输出其 @NAME）
+ * @param what 手势名称
+ * @param tk 调度器（已走完，deadline 为最后一帧的截止时间）
+ * @param syscalls 手势期间的 write() 次数
+ */
+static void report_print(struct touch_dev *td, const char *what, const struct ticker *tk,
+						 unsigned long long syscalls) {
+	if (report_len == 0)
+		return;
+	/* 样本在原位替换为 jitter 后排序（第 i 项只覆盖已读过的样本） */
+	long long *v = (long long *)report_buf;
+	long long end = report_buf[report_len - 1].actual;
+	for (int i = 0; i < report_len; i++)
+		v[i] = report_buf[i].actual - report_buf[i].sched;
+	qsort(v, report_len, sizeof(v[0]), latency_cmp);
+	fprintf(stderr, "report @%s %s: frames %d duration_err_us %lld jitter_us min %lld"
+			" p50 %lld p99 %lld max %lld missed %d syscalls %llu\n",
+			td->name, what, tk->frames, (end - tk->deadline) / 1000,
+			v[0] / 1000, v[report_len / 2] / 1000,
+			v[(int)((long long)report_len * 99 / 100)] / 1000, v[report_len - 1] / 1000,
+			tk->missed, syscalls);
+	report_len = 0;
+}
+
+/**
+ * @brief 读取绝对轴信息
+ * @param fd 设备文件描述符
+ * @param code 轴代码
+ * @param ainfo 存储读取结果的结构体指针
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int read_absinfo(int fd, unsigned int code, struct input_absinfo *ainfo) {
+    return dev_ioctl(fd, EVIOCGABS(code), ainfo) < 0 ? RS_ERR : RS_OK;
+}
+
+/**
+ * @brief 计算一个坐标方向的定点映射参数
+ * @param m 输出的映射参数
+ * @param ax 设备轴信息（优先）
+ * @param fallback 备用轴信息
+ * @param ui UI 逻辑尺寸，0 表示不映射
+ */
+static void axis_map_init(struct axis_map *m, const struct axis_info *ax,
+						  const struct axis_info *fallback, int ui) {
+	m->base = 0;
+	m->scale = 0;
+	if (!ax->valid)
+		ax = fallback;
+	if (!ui || !ax->valid)
+		return;
+	long long scale = ((((long long)ax->max - ax->min) << 16) + ui / 2) / ui;
+	if (scale > MAP_SCALE_MAX) {
+		fprintf(stderr, "axis range %d..%d too large for %d UI units, not mapped\n",
+				ax->min, ax->max, ui);
+		return;
+	}
+	m->base = ax->min;
+	m->scale = scale;
+}
+
+/** 各缓存轴对应的事件代码 */
+static const unsigned int axis_codes[AXIS_COUNT] = {
+	[AXIS_X] = ABS_X,
+	[AXIS_Y] = ABS_Y,
+	[AXIS_MT_X] = ABS_MT_POSITION_X,
+	[AXIS_MT_Y] = ABS_MT_POSITION_Y,
+	[AXIS_PRESSURE] = ABS_MT_PRESSURE,
+	[AXIS_SLOT] = ABS_MT_SLOT,
+	[AXIS_MAJOR] = ABS_MT_TOUCH_MAJOR,
+	[AXIS_MINOR] = ABS_MT_TOUCH_MINOR,
+	[AXIS_ORIENT] = ABS_MT_ORIENTATION,
+	[AXIS_TOOL] = ABS_MT_TOOL_TYPE,
+};
+
+/**
+ * @brief 读取设备的绝对轴信息
+ * @param fd 设备文件描述符
+ * @param axes 输出的轴信息表（AXIS_COUNT 项）
+ */
+static void axis_cache_read(int fd, struct axis_info *axes) {
+	struct input_absinfo ai;
+
+	for (int i = 0; i < AXIS_COUNT; i++) {
+		struct axis_info *ax = &axes[i];
+		ax->valid = read_absinfo(fd, axis_codes[i], &ai) == RS_OK;
+		ax->min = ax->valid ? ai.minimum : 0;
+		ax->max = ax->valid ? ai.maximum : 0;
+		ax->res = ax->valid ? ai.resolution : 0;
+	}
+}
+
+/**
+ * @brief 根据缓存的轴信息和 UI 分辨率计算坐标映射参数
+ * @param td 触摸设备
+ */
+static void axis_cache_map(struct touch_dev *td) {
+	axis_map_init(&td->map_x, &td->axes[AXIS_MT_X], &td->axes[AXIS_X], ui_w);
+	axis_map_init(&td->map_y, &td->axes[AXIS_MT_Y], &td->axes[AXIS_Y], ui_h);
+}
+
+/**
+ * @brief 按 ABS_MT_SLOT 的范围分配 slot 状态表
+ * @param td 触摸设备
+ * @return RS_OK 成功，RS_ERR 内存不足
+ */
+static int slots_init(struct touch_dev *td) {
+	const struct axis_info *ax = &td->axes[AXIS_SLOT];
+	int n = ax->valid ? ax->max + 1 : 1;
+
+	if (slots_opt > 0)
+		n = slots_opt;
+	if (n < 1)
+		n = 1;
+	if (n > SLOTS_LIMIT)
+		n = SLOTS_LIMIT;
+	td->slots = calloc(n, sizeof(*td->slots));
+	if (!td->slots) {
+		fprintf(stderr, "out of memory\n");
+		return RS_ERR;
+	}
+	td->nslots = n;
+	delta_reset(td);
+	td->next_tracking_id = 1;
+	return RS_OK;
+}
+
+/**
+ * @brief 按定点参数映射一个坐标
+ * @param m 映射参数
+ * @param v UI 坐标
+ * @return 设备坐标
+ */
+static inline int axis_map_apply(const struct axis_map *m, int v) {
+	if (!m->scale) return v;
+	return m->base + (int)(((long long)v * m->scale + 0x8000) >> 16);
+}
+
+/**
+ * @brief 映射 UI 坐标到设备坐标（X 轴）
+ * @param td 触摸设备
+ * @param lx UI 屏幕 X 坐标
+ * @return 设备坐标 X
+ */
+static int map_x(struct touch_dev *td, int lx) {
+	stats.maps++;
+	return axis_map_apply(&td->map_x, lx);
+}
+
+/**
+ * @brief 映射 UI 坐标到设备坐标（Y 轴）
+ * @param td 触摸设备
+ * @param ly UI 屏幕 Y 坐标
+ * @return 设备坐标 Y
+ */
+static int map_y(struct touch_dev *td, int ly) {
+	stats.maps++;
+	return axis_map_apply(&td->map_y, ly);
+}
+
+/**
+ * @brief 初始化设备结构，轴范围取虚拟设备的默认值
+ *
+ * 没有真实轴信息的后端（uinput、socket、mem）使用 SCREEN_W/SCREEN_H 和
+ * UINPUT_SLOTS（或 --slots）。
+ * @param td 待初始化的触摸设备
+ */
+static void axis_defaults(struct touch_dev *td) {
+	memset(td, 0, sizeof(*td));
+	td->fd = -1;
+	td->axes[AXIS_X] = (struct axis_info){ 1, 0, SCREEN_W - 1, 0 };
+	td->axes[AXIS_Y] = (struct axis_info){ 1, 0, SCREEN_H - 1, 0 };
+	td->axes[AXIS_MT_X] = td->axes[AXIS_X];
+	td->axes[AXIS_MT_Y] = td->axes[AXIS_Y];
+	td->axes[AXIS_PRESSURE] = (struct axis_info){ 1, 0, 255, 0 };
+	td->axes[AXIS_SLOT] = (struct axis_info){ 1, 0,
+		(slots_opt > 0 ? slots_opt : UINPUT_SLOTS) - 1, 0 };
+	td->axes[AXIS_MAJOR] = (struct axis_info){ 1, 0, 255, 0 };
+	td->axes[AXIS_MINOR] = td->axes[AXIS_MAJOR];
+	td->axes[AXIS_ORIENT] = (struct axis_info){ 1, -90, 90, 0 };
+	td->axes[AXIS_TOOL] = (struct axis_info){ 1, 0, MT_TOOL_PALM, 0 };
+}
+
+/**
+ * @brief 打开套接字转发后端
+ * @param td 待初始化的触摸设备
+ * @param path Unix 域套接字路径
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int open_sock(struct touch_dev *td, const char *path) {
+	struct sockaddr_un addr;
+
+	axis_defaults(td);
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "sock: socket path too long\n");
+		return RS_ERR;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	td->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (td->fd < 0 || connect(td->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "connect %s failed: %s\n", path, strerror(errno));
+		if (td->fd >= 0)
+			close(td->fd);
+		return RS_ERR;
+	}
+	/* 对端关闭时由 write() 返回 EPIPE，而不是被信号终止 */
+	signal(SIGPIPE, SIG_IGN);
+	fcntl(td->fd, F_SETFL, fcntl(td->fd, F_GETFL) | O_NONBLOCK);
+	td->emit = &emit_socket;
+	td->stamp_out = 1;
+	axis_cache_map(td);
+	if (slots_init(td) == RS_ERR) {
+		close(td->fd);
+		return RS_ERR;
+	}
+	return RS_OK;
+}
+
+/**
+ * @brief 打开内存后端
+ * @param td 待初始化的触摸设备
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int open_mem(struct touch_dev *td) {
+	axis_defaults(td);
+	td->emit_ctx = calloc(1, sizeof(struct mem_ring));
+	if (!td->emit_ctx) {
+		fprintf(stderr, "out of memory\n");
+		return RS_ERR;
+	}
+	td->emit = &emit_mem;
+	td->stamp_out = 1;
+	axis_cache_map(td);
+	if (slots_init(td) == RS_ERR) {
+		free(td->emit_ctx);
+		return RS_ERR;
+	}
+	return RS_OK;
+}
+
+/* ------------------ 设备发现 ------------------ */
+
+/*
+ * -d 除了节点路径，还可以给出选择器，在 /dev/input/event* 中按顺序查找
+ * 第一个匹配且带触摸轴（ABS_X 或 ABS_MT_POSITION_X）的设备：
+ *
+ *   name:STR   EVIOCGNAME 包含 STR
+ *   phys:STR   EVIOCGPHYS 包含 STR
+ *   mt:[STR]   带 ABS_MT_POSITION_X/Y，名称包含 STR（可省略）
+ *
+ * --profile FILE 把发现和探测的结果按设备身份（EVIOCGID + 名称）缓存为
+ * 文本文件，每行一个设备：
+ *
+ *   BUS:VENDOR:PRODUCT:VERSION <TAB> 节点 <TAB> 各轴 valid,min,max,res <TAB> phys <TAB> name
+ *
+ * 之后的运行先在档案里匹配选择器，只打开档案记录的节点核对身份，不再
+ * 扫描目录；打开设备时按身份取出轴范围（含 slot 数），不再逐轴 EVIOCGABS。
+ * 节点号变化或设备换了时核对失败，退回扫描和探测并更新档案。轴只在行尾
+ * 追加，旧档案中缺少的轴按无效处理。
+ */
+
+/** 设备身份 */
+struct dev_ident {
+	struct input_id id;			/* 总线、厂商、产品、版本 */
+	char name[DEV_IDENT_LEN];	/* EVIOCGNAME */
+	char phys[DEV_IDENT_LEN];	/* EVIOCGPHYS，可能为空 */
+};
+
+/** 档案中的一个设备 */
+struct dev_profile {
+	struct dev_ident ident;				/* 设备身份 */
+	char path[PATH_MAX];				/* 最近一次的节点路径 */
+	struct axis_info axes[AXIS_COUNT];	/* 轴信息 */
+};
+
+static struct dev_profile *profile_tab = NULL;	/* 已加载的档案，NULL 表示未加载 */
+static int profile_n = 0;						/* 档案条目数 */
+
+/**
+ * @brief 读取设备身份
+ * @param fd 设备文件描述符
+ * @param di 输出的身份
+ * @return RS_OK 成功，RS_ERR 不是 evdev 设备
+ */
+static int ident_read(int fd, struct dev_ident *di) {
+	memset(di, 0, sizeof(*di));
+	if (dev_ioctl(fd, EVIOCGID, &di->id) < 0 ||
+		dev_ioctl(fd, EVIOCGNAME(sizeof(di->name) - 1), di->name) < 0)
+		return RS_ERR;
+	if (dev_ioctl(fd, EVIOCGPHYS(sizeof(di->phys) - 1), di->phys) < 0)
+		di->phys[0] = '\0';
+	/* 档案以 TAB 分隔字段 */
+	for (char *c = di->name; *c; c++)
+		if (*c == '\t' || *c == '\n') *c = ' ';
+	for (char *c = di->phys; *c; c++)
+		if (*c == '\t' || *c == '\n') *c = ' ';
+	return RS_OK;
+}
+
+/**
+ * @brief 比较两个设备身份
+ * @return 1 相同，0 不同
+ */
+static int ident_equal(const struct dev_ident *a, const struct dev_ident *b) {
+	return a->id.bustype == b->id.bustype && a->id.vendor == b->id.vendor &&
+		a->id.product == b->id.product && a->id.version == b->id.version &&
+		strcmp(a->name, b->name) == 0 && strcmp(a->phys, b->phys) == 0;
+}
+
+/**
+ * @brief 判断路径是否为设备选择器
+ * @param path -d 给出的路径
+ * @return 1 是选择器
+ */
+static int is_selector(const char *path) {
+	return strncmp(path, "name:", 5) == 0 || strncmp(path, "phys:", 5) == 0 ||
+		strncmp(path, "mt:", 3) == 0;
+}
+
+/**
+ * @brief 按选择器匹配一个设备
+ * @param sel 选择器
+ * @param di 设备身份
+ * @param touch 是否带 ABS_X 或 ABS_MT_POSITION_X
+ * @param mt 是否带 ABS_MT_POSITION_X/Y
+ * @return 1 匹配
+ */
+static int selector_match(const char *sel, const struct dev_ident *di, int touch, int mt) {
+	if (strncmp(sel, "mt:", 3) == 0)
+		return mt && strstr(di->name, sel + 3) != NULL;
+	if (!touch)
+		return 0;
+	if (strncmp(sel, "name:", 5) == 0)
+		return strstr(di->name, sel + 5) != NULL;
+	return strstr(di->phys, sel + 5) != NULL;
+}
+
+/**
+ * @brief 加载档案文件（只加载一次，文件不存在时为空档案）
+ * @return RS_OK 成功，RS_ERR 内存不足
+ */
+static int profile_load(void) {
+	char line[LINE_MAX_LEN];
+	FILE *fp;
+
+	if (profile_tab)
+		return RS_OK;
+	profile_tab = calloc(PROFILE_MAX, sizeof(*profile_tab));
+	if (!profile_tab) {
+		fprintf(stderr, "out of memory\n");
+		return RS_ERR;
+	}
+	fp = fopen(profile_path, "r");
+	if (!fp)
+		return RS_OK;
+	while (profile_n < PROFILE_MAX && fgets(line, sizeof(line), fp)) {
+		struct dev_profile *pr = &profile_tab[profile_n];
+		char *p = line, *f[5];
+		unsigned int bus, ven, prod, ver;
+		int nf = 0;
+
+		line[strcspn(line, "\n")] = '\0';
+		if (line[0] == '#' || line[0] == '\0')
+			continue;
+		while (nf < 5 && (f[nf] = strsep(&p, "\t")) != NULL)
+			nf++;
+		if (nf < 5 || sscanf(f[0], "%x:%x:%x:%x", &bus, &ven, &prod, &ver) != 4)
+			continue;
+		memset(pr, 0, sizeof(*pr));
+		pr->ident.id.bustype = bus;
+		pr->ident.id.vendor = ven;
+		pr->ident.id.product = prod;
+		pr->ident.id.version = ver;
+		snprintf(pr->path, sizeof(pr->path), "%s", f[1]);
+		snprintf(pr->ident.phys, sizeof(pr->ident.phys), "%s", f[3]);
+		snprintf(pr->ident.name, sizeof(pr->ident.name), "%s", f[4]);
+		char *a = f[2];
+		for (int i = 0; i < AXIS_COUNT; i++) {
+			struct axis_info *ax = &pr->axes[i];
+			int used;
+			if (sscanf(a, "%d,%d,%d,%d%n", &ax->valid, &ax->min, &ax->max, &ax->res, &used) != 4)
+				break;
+			a += used;
+		}
+		profile_n++;
+	}
+	fclose(fp);
+	return RS_OK;
+}
+
+/**
+ * @brief 按身份查找档案条目
+ * @param di 设备身份
+ * @return 条目，没有返回 NULL
+ */
+static struct dev_profile *profile_find(const struct dev_ident *di) {
+	for (int i = 0; i < profile_n; i++) {
+		if (ident_equal(&profile_tab[i].ident, di))
+			return &profile_tab[i];
+	}
+	return NULL;
+}
+
+/**
+ * @brief 记录一个设备并重写档案文件（先写临时文件再改名）
+ * @param di 设备身份
+ * @param path 节点路径
+ * @param axes 轴信息
+ */
+static void profile_store(const struct dev_ident *di, const char *path,
+						  const struct axis_info *axes) {
+	struct dev_profile *pr = profile_find(di);
+	char tmp[PATH_MAX];
+	FILE *fp;
+
+	if (!pr) {
+		/* 满了时丢弃最旧的条目 */
+		if (profile_n == PROFILE_MAX)
+			memmove(profile_tab, profile_tab + 1, sizeof(*profile_tab) * --profile_n);
+		pr = &profile_tab[profile_n++];
+	}
+	pr->ident = *di;
+	snprintf(pr->path, sizeof(pr->path), "%s", path);
+	memcpy(pr->axes, axes, sizeof(pr->axes));
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", profile_path);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		fprintf(stderr, "open %s failed: %s\n", tmp, strerror(errno));
+		return;
+	}
+	fprintf(fp, "# mca_uinput device profile\n");
+	for (int i = 0; i < profile_n; i++) {
+		pr = &profile_tab[i];
+		fprintf(fp, "%04x:%04x:%04x:%04x\t%s\t", pr->ident.id.bustype, pr->ident.id.vendor,
+				pr->ident.id.product, pr->ident.id.version, pr->path);
+		for (int a = 0; a < AXIS_COUNT; a++)
+			fprintf(fp, "%s%d,%d,%d,%d", a ? " " : "", pr->axes[a].valid,
+					pr->axes[a].min, pr->axes[a].max, pr->axes[a].res);
+		fprintf(fp, "\t%s\t%s\n", pr->ident.phys, pr->ident.name);
+	}
+	if (fclose(fp) != 0 || rename(tmp, profile_path) < 0) {
+		fprintf(stderr, "write %s failed: %s\n", profile_path, strerror(errno));
+		unlink(tmp);
+	}
+}
+
+/**
+ * @brief 按档案解析选择器，并核对节点上仍是同一个设备
+ * @param sel 选择器
+ * @param path 输出的节点路径
+ * @param len 路径缓冲长度
+ * @return RS_OK 命中，RS_ERR 未命中
+ */
+static int profile_resolve(const char *sel, char *path, size_t len) {
+	for (int i = 0; i < profile_n; i++) {
+		const struct dev_profile *pr = &profile_tab[i];
+		int mt = pr->axes[AXIS_MT_X].valid && pr->axes[AXIS_MT_Y].valid;
+		if (!selector_match(sel, &pr->ident, mt || pr->axes[AXIS_X].valid, mt))
+			continue;
+		struct dev_ident di;
+		int fd = open(pr->path, O_RDONLY | O_NONBLOCK);
+		int same = fd >= 0 && ident_read(fd, &di) == RS_OK && ident_equal(&di, &pr->ident);
+		if (fd >= 0)
+			close(fd);
+		if (same) {
+			snprintf(path, len, "%s", pr->path);
+			return RS_OK;
+		}
+	}
+	return RS_ERR;
+}
+
+/**
+ * @brief 测试位图中的一位
+ */
+static inline int bit_test(const unsigned long *bits, int n) {
+	return (bits[n / (8 * sizeof(long))] >> (n % (8 * sizeof(long)))) & 1;
+}
+
+/**
+ * @brief 把选择器解析为节点路径
+ * @param sel 选择器
+ * @param path 输出的节点路径
+ * @param len 路径缓冲长度
+ * @return RS_OK 成功，RS_ERR 没有匹配的设备
+ */
+static int dev_resolve(const char *sel, char *path, size_t len) {
+	struct dirent **list;
+	int ret = RS_ERR;
+
+	if (profile_path && profile_load() == RS_OK && profile_resolve(sel, path, len) == RS_OK)
+		return RS_OK;
+
+	/* event2 排在 event10 之前 */
+	int n = scandir(input_dir, &list, NULL, versionsort);
+	if (n < 0) {
+		fprintf(stderr, "scan %s failed: %s\n", input_dir, strerror(errno));
+		return RS_ERR;
+	}
+	for (int i = 0; i < n; i++) {
+		unsigned long abs[ABS_CNT / (8 * sizeof(long)) + 1];
+		struct dev_ident di;
+		char node[PATH_MAX];
+
+		if (ret == RS_ERR && strncmp(list[i]->d_name, "event", 5) == 0) {
+			snprintf(node, sizeof(node), "%s/%s", input_dir, list[i]->d_name);
+			int fd = open(node, O_RDONLY | O_NONBLOCK);
+			memset(abs, 0, sizeof(abs));
+			if (fd >= 0 && ident_read(fd, &di) == RS_OK &&
+				dev_ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs)), abs) >= 0) {
+				int mt = bit_test(abs, ABS_MT_POSITION_X) && bit_test(abs, ABS_MT_POSITION_Y);
+				if (selector_match(sel, &di, mt || bit_test(abs, ABS_X), mt)) {
+					snprintf(path, len, "%s", node);
+					ret = RS_OK;
+				}
+			}
+			if (fd >= 0)
+				close(fd);
+		}
+		free(list[i]);
+	}
+	free(list);
+	if (ret == RS_ERR)
+		fprintf(stderr, "no input device matches '%s'\n", sel);
+	return ret;
+}
+
+/**
+ * @brief 打开输入设备并缓存其轴信息
+ * @param td 待初始化的触摸设备
+ * @param path 输入设备路径（如 /dev/input/eventX），sock:PATH 或 mem: 选择对应后端
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int open_dev(struct touch_dev *td, const char *path) {
+	if (strncmp(path, "sock:", 5) == 0)
+		return open_sock(td, path + 5);
+	if (strcmp(path, "mem:") == 0)
+		return open_mem(td);
+
+	memset(td, 0, sizeof(*td));
+    td->fd = open(path, O_WRONLY | O_NONBLOCK);
+    if (td->fd < 0) {
+		fprintf(stderr, "open %s failed: %s\n", path, strerror(errno));
+		return RS_ERR;
+	}
+	td->emit = &emit_evdev;
+	/* -d 指向普通文件或管道时没有内核替换时间戳 */
+	struct stat st;
+	td->stamp_out = fstat(td->fd, &st) == 0 && !S_ISCHR(st.st_mode);
+
+	/* 档案中有同一设备时直接使用记录的轴范围 */
+	struct dev_ident di;
+	struct dev_profile *pr = NULL;
+	int known = profile_path && profile_load() == RS_OK && ident_read(td->fd, &di) == RS_OK;
+	if (known)
+		pr = profile_find(&di);
+	if (pr) {
+		memcpy(td->axes, pr->axes, sizeof(td->axes));
+		if (strcmp(pr->path, path) != 0)
+			profile_store(&di, path, pr->axes);
+	} else {
+		axis_cache_read(td->fd, td->axes);
+		if (known)
+			profile_store(&di, path, td->axes);
+	}
+	axis_cache_map(td);
+	if (slots_init(td) == RS_ERR) {
+		close(td->fd);
+		return RS_ERR;
+	}
+    return RS_OK;
+}
+
+/* ------------------ 虚拟设备 ------------------ */
+
+/*
+ * --uinput 通过 /dev/uinput 创建独立的虚拟多点触摸屏（INPUT_PROP_DIRECT），
+ * 注入的事件不再与真实硬件的事件混在同一个节点里。轴范围默认取
+ * SCREEN_W/SCREEN_H，同时给出 -d 时从真实设备复制。创建代价较高，
+ * 需要反复注入时应配合 serve 模式只创建一次。
+ */
+
+/**
+ * @brief 向 uinput 声明一个绝对轴
+ * @param fd uinput 描述符
+ * @param code 轴代码
+ * @param ax 轴范围
+ * @param uud 旧式接口下的设备描述（同时填写）
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int uinput_abs(int fd, unsigned int code, const struct axis_info *ax,
+					  struct uinput_user_dev *uud) {
+	if (dev_ioctl(fd, UI_SET_ABSBIT, code) < 0)
+		return RS_ERR;
+	uud->absmin[code] = ax->min;
+	uud->absmax[code] = ax->max;
+#ifdef UI_ABS_SETUP
+	struct uinput_abs_setup abs;
+	memset(&abs, 0, sizeof(abs));
+	abs.code = code;
+	abs.absinfo.minimum = ax->min;
+	abs.absinfo.maximum = ax->max;
+	abs.absinfo.resolution = ax->res;
+	dev_ioctl(fd, UI_ABS_SETUP, &abs);
+#endif
+	return RS_OK;
+}
+
+/**
+ * @brief 创建虚拟触摸屏
+ * @param td 待初始化的触摸设备
+ * @param clone_path 复制轴范围的真实设备路径，NULL 表示使用默认范围
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int open_uinput(struct touch_dev *td, const char *clone_path) {
+	struct uinput_user_dev uud;
+	struct axis_info tracking = { 1, 0, 65535, 0 };
+	int fd;
+
+	axis_defaults(td);
+
+	if (clone_path) {
+		struct axis_info real[AXIS_COUNT];
+		fd = open(clone_path, O_RDONLY | O_NONBLOCK);
+		if (fd < 0) {
+			fprintf(stderr, "open %s failed: %s\n", clone_path, strerror(errno));
+			return RS_ERR;
+		}
+		axis_cache_read(fd, real);
+		close(fd);
+		for (int i = 0; i < AXIS_COUNT; i++) {
+			if (real[i].valid)
+				td->axes[i] = real[i];
+		}
+	}
+
+	fd = open(uinput_path, O_WRONLY | O_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "open %s failed: %s\n", uinput_path, strerror(errno));
+		return RS_ERR;
+	}
+
+	memset(&uud, 0, sizeof(uud));
+	snprintf(uud.name, sizeof(uud.name), "%s", UINPUT_NAME);
+	uud.id.bustype = BUS_VIRTUAL;
+	uud.id.vendor = 0x1;
+	uud.id.product = 0x1;
+	uud.id.version = 1;
+
+	int ok = dev_ioctl(fd, UI_SET_EVBIT, EV_SYN) >= 0 &&
+		dev_ioctl(fd, UI_SET_EVBIT, EV_KEY) >= 0 &&
+		dev_ioctl(fd, UI_SET_EVBIT, EV_ABS) >= 0 &&
+		dev_ioctl(fd, UI_SET_KEYBIT, BTN_TOUCH) >= 0 &&
+		dev_ioctl(fd, UI_SET_KEYBIT, BTN_TOOL_FINGER) >= 0 &&
+		dev_ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_DIRECT) >= 0;
+	for (int i = 0; ok && i < AXIS_COUNT; i++)
+		ok = uinput_abs(fd, axis_codes[i], &td->axes[i], &uud) == RS_OK;
+	ok = ok && uinput_abs(fd, ABS_MT_TRACKING_ID, &tracking, &uud) == RS_OK;
+
+	if (ok) {
+#ifdef UI_DEV_SETUP
+		struct uinput_setup us;
+		memset(&us, 0, sizeof(us));
+		us.id = uud.id;
+		memcpy(us.name, uud.name, sizeof(us.name));
+		/* 旧内核不支持 UI_DEV_SETUP 时退回 write(uinput_user_dev) */
+		if (dev_ioctl(fd, UI_DEV_SETUP, &us) < 0)
+#endif
+			ok = write(fd, &uud, sizeof(uud)) == sizeof(uud);
+	}
+	if (!ok || dev_ioctl(fd, UI_DEV_CREATE) < 0) {
+		fprintf(stderr, "create uinput device failed: %s\n", strerror(errno));
+		close(fd);
+		return RS_ERR;
+	}
+
+	td->fd = fd;
+	td->is_uinput = 1;
+	td->emit = &emit_uinput;
+	axis_cache_map(td);
+	if (slots_init(td) == RS_ERR) {
+		dev_ioctl(fd, UI_DEV_DESTROY);
+		close(fd);
+		return RS_ERR;
+	}
+
+	/* 等待 udev 和上层输入栈打开新设备，否则最初的事件没有读者 */
+	msleep(UINPUT_SETTLE_MS);
+	return RS_OK;
+}
+
+/**
+ * @brief 关闭设备，虚拟设备同时销毁
+ * @param td 触摸设备
+ */
+static void close_dev(struct touch_dev *td) {
+	if (!td->emit)
+		return;
+	if (td->emit->close)
+		td->emit->close(td);
+	td->emit = NULL;
+	free(td->slots);
+	td->slots = NULL;
+	td->nslots = 0;
+}
+
+/**
+ * @brief 设置 BTN_TOUCH 状态
+ * @param td 触摸设备
+ * @param val 状态值（1 按下，0 抬起）
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int btn_touch_set(struct touch_dev *td, int val) {
+    if (write_event(td, EV_KEY, BTN_TOUCH, val) == RS_ERR) {
+		return RS_ERR;
+	}
+    return syn(td);
+}
+
+/**
+ * @brief 放弃当前操作时抬起所有触点
+ *
+ * 丢弃未提交的帧和突发批次，把所有 slot 的 tracking ID 置为 -1，并松开
+ * BTN_TOUCH/BTN_TOOL_FINGER，避免手势中途失败后触点一直按着。出错后
+ * 影子值已作废，这些事件都会完整写出。
+ * @param td 触摸设备
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int touch_cleanup(struct touch_dev *td) {
+	td->frame_len = 0;
+	td->frame_done = 0;
+	td->frame_hold = 0;
+	td->frame_err = 0;
+	for (int s = 0; s < td->nslots; s++) {
+		td->slots[s].tracking_id = 0;
+		td->slots[s].dirty = 0;
+		if (write_event(td, EV_ABS, ABS_MT_SLOT, s) == RS_ERR ||
+			write_event(td, EV_ABS, ABS_MT_TRACKING_ID, -1) == RS_ERR)
+			return RS_ERR;
+	}
+	td->active_touches = 0;
+	if (write_event(td, EV_KEY, BTN_TOUCH, 0) == RS_ERR ||
+		write_event(td, EV_KEY, BTN_TOOL_FINGER, 0) == RS_ERR ||
+		syn_mt(td) == RS_ERR ||
+		syn(td) == RS_ERR) {
+		fprintf(stderr, "release after failure failed, touch may be stuck\n");
+		return RS_ERR;
+	}
+	return RS_OK;
+}
+
+/* ------------------ 接触参数 ------------------ */
+
+/*
+ * contact 命令设置按下时附带的压力、接触椭圆、方向和工具类型，设备不支持
+ * 或未设置的轴不发出。给出 START:END 的参数在 swipe 和多指手势中逐帧线性
+ * 过渡，各帧的值和坐标一起在帧表里预先算好，影子值照常抑制不变的轴。
+ */
+
+/** 各接触参数对应的缓存轴 */
+static const int contact_axis[CT_COUNT] = {
+	[CT_PRESSURE] = AXIS_PRESSURE,
+	[CT_MAJOR] = AXIS_MAJOR,
+	[CT_MINOR] = AXIS_MINOR,
+	[CT_ORIENT] = AXIS_ORIENT,
+	[CT_TOOL] = AXIS_TOOL,
+};
+
+/** contact 命令的参数名 */
+static const char *const contact_keys[CT_COUNT] = {
+	[CT_PRESSURE] = "p",
+	[CT_MAJOR] = "major",
+	[CT_MINOR] = "minor",
+	[CT_ORIENT] = "orient",
+	[CT_TOOL] = "tool",
+};
+
+/** contact 命令各参数的取值范围（命令的单位） */
+static const int contact_range[CT_COUNT][2] = {
+	[CT_PRESSURE] = { 0, 100 },
+	[CT_MAJOR] = { 0, COORD_LIMIT },
+	[CT_MINOR] = { 0, COORD_LIMIT },
+	[CT_ORIENT] = { -90, 90 },
+	[CT_TOOL] = { 0, MT_TOOL_MAX },
+};
+
+/**
+ * @brief 计算接触参数在手势进度 t 处的设备值
+ * @param td 触摸设备
+ * @param k 参数（CT_*）
+ * @param t 进度，0 为按下，1 为结束
+ * @return 限制在轴范围内的设备值
+ */
+static int contact_value(struct touch_dev *td, int k, double t) {
+	const struct axis_info *ax = &td->axes[contact_axis[k]];
+	double v = td->contact.start[k] + (td->contact.end[k] - td->contact.start[k]) * t;
+	double range = (double)ax->max - ax->min;
+
+	switch (k) {
+	case CT_PRESSURE:
+		v = ax->min + v * range / 100.0;
+		break;
+	case CT_MAJOR:
+	case CT_MINOR:
+		/* 长短轴与 X 方向按同一比例换算到设备单位 */
+		if (td->map_x.scale)
+			v = v * td->map_x.scale / 65536.0;
+		break;
+	case CT_ORIENT:
+		v = ax->min + (v + 90.0) * range / 180.0;
+		break;
+	default:
+		/* 工具类型不插值 */
+		v = td->contact.start[k];
+		break;
+	}
+	int r = (int)floor(v + 0.5);
+	if (r < ax->min)
+		r = ax->min;
+	if (r > ax->max)
+		r = ax->max;
+	return r;
+}
+
+/**
+ * @brief 判断是否需要发出某个接触参数
+ * @param td 触摸设备
+ * @param k 参数（CT_*）
+ * @return 已设置且设备支持该轴时为 1
+ */
+static inline int contact_used(struct touch_dev *td, int k) {
+	return (td->contact.set & (1 << k)) && td->axes[contact_axis[k]].valid;
+}
+
+/**
+ * @brief 把按下时的接触轴写入当前帧
+ * @param td 触摸设备（已选中 slot）
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int contact_write(struct touch_dev *td) {
+	for (int k = 0; k < CT_COUNT; k++) {
+		if (contact_used(td, k) &&
+			write_event(td, EV_ABS, axis_codes[contact_axis[k]], contact_value(td, k, 0)) == RS_ERR)
+			return RS_ERR;
+	}
+	return RS_OK;
+}
+
+/**
+ * @brief 为预计算帧表生成一帧的接触轴事件
+ * @param td 触摸设备
+ * @param last 该触点的 MT 影子值（MT_CODE_COUNT 项）
+ * @param ev 输出事件（至少 CT_COUNT 项）
+ * @param t 手势进度
+ * @return 生成的事件数，未变化的轴不生成
+ */
+static int contact_put(struct touch_dev *td, int *last, struct input_event *ev, double t) {
+	int n = 0;
+	for (int k = 0; k < CT_COUNT; k++) {
+		if (!contact_used(td, k))
+			continue;
+		unsigned int code = axis_codes[contact_axis[k]];
+		int v = contact_value(td, k, t);
+		if (shadow_update(&last[code - MT_CODE_FIRST], v))
+			ev_set(&ev[n++], EV_ABS, code, v);
+	}
+	return n;
+}
+
+/**
+ * @brief contact 命令：更新接触参数
+ * @param td 触摸设备
+ * @param clear 非 0 时先清除全部参数（命令中出现了 off）
+ * @param c 随后设置的参数（已由 contact_parse() 校验）
+ * @return RS_OK
+ */
+static int contact_set(struct touch_dev *td, int clear, const struct contact *c) {
+	if (clear)
+		memset(&td->contact, 0, sizeof(td->contact));
+	for (int k = 0; k < CT_COUNT; k++) {
+		if (!(c->set & (1 << k)))
+			continue;
+		td->contact.start[k] = c->start[k];
+		td->contact.end[k] = c->end[k];
+		td->contact.set |= 1 << k;
+	}
+	for (int k = 0; k < CT_COUNT; k++) {
+		if ((td->contact.set & (1 << k)) && !td->axes[contact_axis[k]].valid)
+			fprintf(stderr, "contact: device has no %s axis, ignored\n", contact_keys[k]);
+	}
+	return RS_OK;
+}
+
+/* ------------------ 轨迹 ------------------ */
+
+/*
+ * 滑动轨迹在手指按下之前整体预计算：每一步的坐标经 map_x/map_y 映射为
+ * 设备坐标后直接编码成 input_event 帧，按帧存放在一块连续内存里。
+ * 定时循环中只剩等待截止时间和 write()，没有浮点运算和坐标映射。
+ * 预计算帧的时间戳为 0，写出前由 frames_stamp() 按 --clock 补上。
+ */
+
+/** 轨迹类型 */
+enum path_type {
+	PATH_LINEAR,	/* 匀速直线 */
+	PATH_EASE,		/* 直线，先加速后减速 */
+	PATH_EASE_IN,	/* 直线，加速 */
+	PATH_EASE_OUT,	/* 直线，减速 */
+	PATH_FLING,		/* 直线，指数衰减的惯性减速 */
+	PATH_BEZIER,	/* 二次贝塞尔曲线 */
+	PATH_CIRCLE,	/* 绕终点画圆弧 */
+};
+
+/** 轨迹参数 */
+struct path {
+	enum path_type type;	/* 轨迹类型 */
+	double a;				/* bezier: 控制点 X；circle: 扫过角度（度） */
+	double b;				/* bezier: 控制点 Y */
+	int has_arg;			/* 是否显式给出参数 */
+};
+
+/** 预计算的轨迹帧表 */
+struct traj {
+	struct input_event *ev;	/* 所有帧的事件，连续存放 */
+	int *off;				/* 第 i 帧为 ev[off[i]] .. ev[off[i+1]-1] */
+	int frames;				/* 帧数 */
+};
+
+/**
+ * @brief 解析轨迹描述
+ *
+ * 格式：linear | ease | ease-in | ease-out | fling | bezier[:CX:CY] | circle[:DEG]
+ *
+ * @param s 轨迹描述
+ * @param p 输出的轨迹参数
+ * @return RS_OK 成功，RS_ERR 无法识别
+ */
+static int path_parse(const char *s, struct path *p) {
+	static const struct { const char *name; enum path_type type; } names[] = {
+		{ "linear", PATH_LINEAR },
+		{ "ease", PATH_EASE },
+		{ "ease-in", PATH_EASE_IN },
+		{ "ease-out", PATH_EASE_OUT },
+		{ "fling", PATH_FLING },
+		{ "bezier", PATH_BEZIER },
+		{ "circle", PATH_CIRCLE },
+	};
+	const char *colon = strchr(s, ':');
+	size_t len = colon ? (size_t)(colon - s) : strlen(s);
+
+	memset(p, 0, sizeof(*p));
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strlen(names[i].name) != len || strncmp(s, names[i].name, len) != 0)
+			continue;
+		p->type = names[i].type;
+		if (!colon)
+			return RS_OK;
+		if (p->type == PATH_BEZIER &&
+			sscanf(colon + 1, "%lf:%lf", &p->a, &p->b) == 2) {
+			p->has_arg = 1;
+			return RS_OK;
+		}
+		if (p->type == PATH_CIRCLE && sscanf(colon + 1, "%lf", &p->a) == 1) {
+			p->has_arg = 1;
+			return RS_OK;
+		}
+		break;
+	}
+	fprintf(stderr, "unknown path '%s'\n", s);
+	return RS_ERR;
+}
+
+/**
+ * @brief 计算轨迹上 t 时刻的 UI 坐标
+ * @param p 轨迹参数
+ * @param x1 起点 X
+ * @param y1 起点 Y
+ * @param x2 终点 X（circle 为圆心 X）
+ * @param y2 终点 Y（circle 为圆心 Y）
+ * @param t 归一化时间 [0, 1]
+ * @param x 输出 X
+ * @param y 输出 Y
+ */
+static void path_point(const struct path *p, int x1, int y1, int x2, int y2,
+					   double t, double *x, double *y) {
+	double dx = x2 - x1, dy = y2 - y1;
+	double u = t;
+
+	switch (p->type) {
+	case PATH_EASE:
+		u = t * t * (3 - 2 * t);
+		break;
+	case PATH_EASE_IN:
+		u = t * t;
+		break;
+	case PATH_EASE_OUT:
+		u = 1 - (1 - t) * (1 - t);
+		break;
+	case PATH_FLING:
+		u = (1 - exp(-FLING_DECAY * t)) / (1 - exp(-FLING_DECAY));
+		break;
+	case PATH_BEZIER: {
+		/* 未给控制点时取中点沿法向偏移 1/4 弦长 */
+		double cx = p->has_arg ? p->a : x1 + dx / 2 - dy / 4;
+		double cy = p->has_arg ? p->b : y1 + dy / 2 + dx / 4;
+		double s = 1 - t;
+		*x = s * s * x1 + 2 * s * t * cx + t * t * x2;
+		*y = s * s * y1 + 2 * s * t * cy + t * t * y2;
+		return;
+	}
+	case PATH_CIRCLE: {
+		double sweep = (p->has_arg ? p->a : 360.0) * M_PI / 180.0;
+		double r = sqrt(dx * dx + dy * dy);
+		double a0 = atan2(-dy, -dx);
+		*x = x2 + r * cos(a0 + sweep * t);
+		*y = y2 + r * sin(a0 + sweep * t);
+		return;
+	}
+	default:
+		break;
+	}
+	*x = x1 + dx * u;
+	*y = y1 + dy * u;
+}
+
+/**
+ * @brief 确定手势的帧数
+ * @param duration_ms 手势总时长（毫秒）
+ * @param steps 命令给出的步数
+ * @return 实际帧数：设置了 --rate 时由报告率推算，结果限制在 [1, TRAJ_MAX_FRAMES]
+ */
+static int gesture_steps(int duration_ms, int steps) {
+	if(rate_hz > 0) {
+		steps = (int)((long long)duration_ms * rate_hz / 1000);
+		if(steps < 1) steps = 1;
+	}
+    if(steps < 1) {
+		steps = 10;
+	}
+	if(steps > TRAJ_MAX_FRAMES) {
+		steps = TRAJ_MAX_FRAMES;
+	}
+	return steps;
+}
+
+/**
+ * @brief 预计算单指滑动的轨迹帧表
+ * @param td 触摸设备（用于坐标映射）
+ * @param tr 输出的帧表
+ * @param p 轨迹参数
+ * @param x1 起点 X
+ * @param y1 起点 Y
+ * @param x2 终点 X
+ * @param y2 终点 Y
+ * @param steps 帧数
+ * @return RS_OK 成功，RS_ERR 内存不足
+ */
+static int traj_build(struct touch_dev *td, struct traj *tr, const struct path *p,
+					  int x1, int y1, int x2, int y2, int steps) {
+	int last[MT_CODE_COUNT];
+
+	tr->frames = steps;
+	tr->ev = malloc(sizeof(*tr->ev) * steps * (3 + CT_COUNT));
+	tr->off = malloc(sizeof(*tr->off) * (steps + 1));
+	if (!tr->ev || !tr->off) {
+		free(tr->ev);
+		free(tr->off);
+		fprintf(stderr, "out of memory\n");
+		return RS_ERR;
+	}
+
+	/*
+	 * 影子值随预计算一起推进，未变化的轴不写，整帧未变化则为空帧。
+	 * 单点按下帧不选 slot，接触轴的影子值从按下时的值开始单独推进。
+	 */
+	struct input_event seed[CT_COUNT];
+	for (int i = 0; i < MT_CODE_COUNT; i++)
+		last[i] = SHADOW_UNKNOWN;
+	contact_put(td, last, seed, 0);
+	int n = 0;
+	for (int i = 0; i < steps; i++) {
+		double x, y;
+		double t = (double)(i + 1) / steps;
+		int start = n;
+		path_point(p, x1, y1, x2, y2, t, &x, &y);
+		tr->off[i] = n;
+		int dx = map_x(td, (int)floor(x + 0.5));
+		int dy = map_y(td, (int)floor(y + 0.5));
+		if (shadow_update(&td->abs_last[ABS_X], dx))
+			ev_set(&tr->ev[n++], EV_ABS, ABS_X, dx);
+		if (shadow_update(&td->abs_last[ABS_Y], dy))
+			ev_set(&tr->ev[n++], EV_ABS, ABS_Y, dy);
+		n += contact_put(td, last, &tr->ev[n], t);
+		if (n > start)
+			ev_set(&tr->ev[n++], EV_SYN, SYN_REPORT, 0);
+	}
+	tr->off[steps] = n;
+	return RS_OK;
+}
+
+/**
+ * @brief 释放轨迹帧表
+ * @param tr 帧表
+ */
+static void traj_free(struct traj *tr) {
+	free(tr->ev);
+	free(tr->off);
+	tr->ev = NULL;
+	tr->off = NULL;
+}
+
+/**
+ * @brief 按截止时间逐帧发出轨迹
+ * @param td 触摸设备
+ * @param tr 帧表
+ * @param duration_ms 总时长（毫秒），帧均匀分布
+ * @param what 手势名称（用于报告）
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int traj_play(struct touch_dev *td, struct traj *tr, int duration_ms,
+					 const char *what) {
+	struct ticker tk;
+
+	unsigned long long syscalls = stats.syscalls;
+	int report = report_buf != NULL;
+
+	report_len = 0;
+	ticker_start(&tk, duration_ms, tr->frames);
+	long long t0 = tk.deadline;
+	for (int i = 0; i < tr->frames; ) {
+		int due = ticker_next(&tk);
+		int n = tr->off[i + due] - tr->off[i];
+		/* 帧在表中连续存放，到期的多帧一次写出 */
+		if (n > 0)
+			frames_stamp(td, tr->ev + tr->off[i], n);
+		if (n > 0 && write_frames(td, tr->ev + tr->off[i], n) == RS_ERR) {
+			delta_reset(td);
+			return RS_ERR;
+		}
+		if (n > 0 && report)
+			report_add(&tk, due, mono_ns());
+		i += due;
+	}
+	span_record(what, t0, mono_ns());
+	ticker_report(&tk, what);
+	if (report)
+		report_print(td, what, &tk, stats.syscalls - syscalls);
+	return RS_OK;
+}
+
+/* ------------------ 单点操作 ------------------ */
+
+/**
+ * @brief 单点点击
+ * @param td 触摸设备
+ * @param lx UI 屏幕 X 坐标
+ * @param ly UI 屏幕 Y 坐标
+ * @param hold_ms 按下保持时间（毫秒）
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int do_tap(struct touch_dev *td, int lx, int ly, int hold_ms) {
+    int x = map_x(td, lx);
+	int y = map_y(td, ly);
+	long long t0 = mono_ns();
+	if (write_event(td, EV_KEY, BTN_TOUCH, 1) == RS_ERR ||
+		write_event(td, EV_KEY, BTN_TOOL_FINGER, 1) == RS_ERR ||
+		write_event(td, EV_ABS, ABS_MT_POSITION_X, x) == RS_ERR ||
+		write_event(td, EV_ABS, ABS_MT_POSITION_Y, y) == RS_ERR ||
+		contact_write(td) == RS_ERR ||
+		syn_mt(td) == RS_ERR ||
+		syn(td) == RS_ERR) {
+		touch_cleanup(td);
+		return RS_ERR;
+	}
+
+    sleep_until(t0 + hold_ms * 1000000LL);
+
+    if (write_event(td, EV_KEY, BTN_TOUCH, 0) == RS_ERR ||
+		write_event(td, EV_KEY, BTN_TOOL_FINGER, 0) == RS_ERR ||
+		syn_mt(td) == RS_ERR ||
+        syn(td) == RS_ERR) {
+		touch_cleanup(td);
+        return RS_ERR;
+    }
+    return RS_OK;
+}
+
+/**
+ * @brief 按下操作（不抬起）
+ * @param td 触摸设备
+ * @param lx UI 屏幕 X 坐标
+ * @param ly UI 屏幕 Y 坐标
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int do_press(struct touch_dev *td, int lx, int ly) {
+    int x = map_x(td, lx);
+	int y = map_y(td, ly);
+	if (write_event(td, EV_KEY, BTN_TOUCH, 1) == RS_ERR ||
+		write_event(td, EV_KEY, BTN_TOOL_FINGER, 1) == RS_ERR ||
+		write_event(td, EV_ABS, ABS_MT_POSITION_X, x) == RS_ERR ||
+		write_event(td, EV_ABS, ABS_MT_POSITION_Y, y) == RS_ERR ||
+		contact_write(td) == RS_ERR ||
+		syn_mt(td) == RS_ERR ||
+		syn(td) == RS_ERR) {
+		return RS_ERR;
+	}
+	return RS_OK;
+}
+
+/**
+ * @brief 抬起操作
+ * @param td 触摸设备
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int do_release(struct touch_dev *td) {
+    if (write_event(td, EV_KEY, BTN_TOUCH, 0) == RS_ERR ||
+		write_event(td, EV_KEY, BTN_TOOL_FINGER, 0) == RS_ERR ||
+		syn_mt(td) == RS_ERR ||
+        syn(td) == RS_ERR) {
+        return RS_ERR;
+    }
+    return RS_OK;
+}
+
+/**
+ * @brief 长按
+ * @param td 触摸设备
+ * @param lx UI 屏幕 X 坐标
+ * @param ly UI 屏幕 Y 坐标
+ * @param hold_ms 按下保持时间（毫秒）
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int do_longpress(struct touch_dev *td, int lx, int ly, int hold_ms) {
+    return do_tap(td, lx, ly, hold_ms);
+}
+
+/**
+ * @brief 滑动操作
+ * @param td 触摸设备
+ * @param x1 起点 X 坐标
+ * @param y1 起点 Y 坐标
+ * @param x2 终点 X 坐标
+ * @param y2 终点 Y 坐标
+ * @param duration_ms 滑动总时长（毫秒）
+ * @param steps 滑动步数（设置了 --rate 时由报告率推算）
+ * @param p 轨迹参数
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int do_swipe(struct touch_dev *td,int x1,int y1,int x2,int y2,int duration_ms,int steps,
+					const struct path *p) {
+	struct traj tr;
+	int ret;
+
+	steps = gesture_steps(duration_ms, steps);
+
+	/* 先算好全部帧再按下，定时循环里只写不算 */
+	if(traj_build(td, &tr, p, x1, y1, x2, y2, steps) == RS_ERR) {
+		return RS_ERR;
+	}
+
+	/* 第 i 步在 t0 + i * duration / steps 时刻发出，最后一步恰好在 duration */
+    ret = do_press(td, x1, y1);
+	if (ret == RS_OK)
+		ret = traj_play(td, &tr, duration_ms, "swipe");
+	traj_free(&tr);
+	if (ret == RS_ERR || do_release(td) == RS_ERR) {
+		/* 中途失败时仍保证发出抬起帧 */
+		touch_cleanup(td);
+		return RS_ERR;
+	}
+    return RS_OK;
+}
+
+/* ------------------ 多点 MT 操作 ------------------ */
+
+/**
+ * @brief 分配新的 tracking ID（1..1000000 循环）
+ * @param td 触摸设备（tracking ID 按设备分配）
+ * @return tracking ID
+ */
+static int alloc_tracking_id(struct touch_dev *td) {
+    int tid = td->next_tracking_id++;
+    if (td->next_tracking_id > 1000000) {
+		td->next_tracking_id = 1;
+	}
+	return tid;
+}
+
+/**
+ * @brief 多点触控按下
+ * @param td 触摸设备
+ * @param slot 触控点 slot 编号
+ * @param lx UI 屏幕 X 坐标
+ * @param ly UI 屏幕 Y 坐标
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int mt_down(struct touch_dev *td, int slot, int lx, int ly) {
+    if (slot < 0 || slot >= td->nslots) 
+		return RS_ERR;
+
+	struct slot_state *ss = &td->slots[slot];
+    int x = map_x(td, lx);
+	int y = map_y(td, ly);
+    int tid = alloc_tracking_id(td);
+
+	/* 重复按下同一 slot 时沿用新的 tracking ID，不重复计数 */
+	int was_down = ss->tracking_id != 0;
+    ss->tracking_id = tid;
+	ss->x = x;
+	ss->y = y;
+	ss->dirty = 0;
+
+	/* BTN_TOUCH 帧与 slot 帧合并为一次提交 */
+	burst_begin(td);
+	if ((td->active_touches == 0 && btn_touch_set(td, 1) == RS_ERR) ||
+		write_event(td, EV_ABS, ABS_MT_SLOT, slot) == RS_ERR ||	
+		write_event(td, EV_ABS, ABS_MT_TRACKING_ID, tid) == RS_ERR ||
+		write_event(td, EV_ABS, ABS_MT_POSITION_X, x) == RS_ERR ||
+		write_event(td, EV_ABS, ABS_MT_POSITION_Y, y) == RS_ERR ||
+		contact_write(td) == RS_ERR ||
+		syn_mt(td) == RS_ERR ||
+		syn(td) == RS_ERR) {
+		ss->tracking_id = 0;
+		if (was_down && td->active_touches > 0)
+			td->active_touches--;
+		return burst_end(td, 0);
+	}
+	if (!was_down)
+		td->active_touches++;
+
+    return burst_end(td, 1);
+}
+
+/**
+ * @brief 多点触控移动
+ * @param td 触摸设备
+ * @param slot 触控点 slot 编号
+ * @param lx UI 屏幕 X 坐标
+ * @param ly UI 屏幕 Y 坐标
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int mt_move(struct touch_dev *td, int slot, int lx, int ly) {
+    if (slot < 0 || slot >= td->nslots || td->slots[slot].tracking_id == 0) 
+		return RS_ERR;
+
+	struct slot_state *ss = &td->slots[slot];
+    int x = map_x(td, lx);
+	int y = map_y(td, ly);
+	ss->x = x;
+	ss->y = y;
+	ss->dirty = 0;
+
+	if (write_event(td, EV_ABS, ABS_MT_SLOT, slot) == RS_ERR ||	
+		write_event(td, EV_ABS, ABS_MT_POSITION_X, x) == RS_ERR ||
+		write_event(td, EV_ABS, ABS_MT_POSITION_Y, y) == RS_ERR ||
+		syn_mt(td) == RS_ERR ||
+		syn(td) == RS_ERR) {
+		return RS_ERR;
+	}
+
+    return RS_OK;
+}
+
+/**
+ * @brief 在一帧内更新多个已按下的触点
+ *
+ * 先把所有更新记到 slot 状态表，再按 slot 顺序一次性发出有变化的轴，
+ * 整帧只有一个 SYN_REPORT，各手指在同一帧里同时移动。
+ *
+ * @param td 触摸设备
+ * @param u 更新列表
+ * @param n 更新个数
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int mt_frame(struct touch_dev *td, const struct slot_update *u, int n) {
+	int changed = 0;
+
+	for (int i = 0; i < n; i++) {
+		if (u[i].slot < 0 || u[i].slot >= td->nslots ||
+			td->slots[u[i].slot].tracking_id == 0) {
+			fprintf(stderr, "mt-frame: slot %d is not down\n", u[i].slot);
+			return RS_ERR;
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+		struct slot_state *ss = &td->slots[u[i].slot];
+		int x = map_x(td, u[i].x);
+		int y = map_y(td, u[i].y);
+		if (x != ss->x) {
+			ss->x = x;
+			ss->dirty |= SLOT_DIRTY_X;
+		}
+		if (y != ss->y) {
+			ss->y = y;
+			ss->dirty |= SLOT_DIRTY_Y;
+		}
+	}
+
+	/* 从当前 slot 开始轮询，可少一次 ABS_MT_SLOT 切换 */
+	int first = td->cur_slot >= 0 && td->cur_slot < td->nslots ? td->cur_slot : 0;
+	for (int k = 0; k < td->nslots; k++) {
+		int slot = (first + k) % td->nslots;
+		struct slot_state *ss = &td->slots[slot];
+		if (!ss->dirty)
+			continue;
+		if (write_event(td, EV_ABS, ABS_MT_SLOT, slot) == RS_ERR ||
+			((ss->dirty & SLOT_DIRTY_X) &&
+			 write_event(td, EV_ABS, ABS_MT_POSITION_X, ss->x) == RS_ERR) ||
+			((ss->dirty & SLOT_DIRTY_Y) &&
+			 write_event(td, EV_ABS, ABS_MT_POSITION_Y, ss->y) == RS_ERR)) {
+			return RS_ERR;
+		}
+		ss->dirty = 0;
+		changed = 1;
+	}
+
+	return changed ? syn(td) : RS_OK;
+}
+
+/**
+ * @brief 多点触控抬起
+ * @param td 触摸设备
+ * @param slot 触控点 slot 编号
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int mt_up(struct touch_dev *td, int slot) {
+	if (slot < 0 || slot >= td->nslots || td->slots[slot].tracking_id == 0)
+		return RS_ERR;
+
+	/* slot 帧与最后一指的 BTN_TOUCH 帧合并为一次提交 */
+	burst_begin(td);
+	if (write_event(td, EV_ABS, ABS_MT_SLOT, slot) == RS_ERR ||	
+		write_event(td, EV_ABS, ABS_MT_TRACKING_ID, -1) == RS_ERR ||
+		syn_mt(td) == RS_ERR ||
+		syn(td) == RS_ERR ||
+		(td->active_touches <= 1 && btn_touch_set(td, 0) == RS_ERR)) {
+		return burst_end(td, 0);
+	}
+
+    td->slots[slot].tracking_id = 0;
+    if (--td->active_touches <= 0) {
+        td->active_touches = 0;
+    }
+
+    return burst_end(td, 1);
+}
+
+/* ------------------ 多指手势 ------------------ */
+
+/*
+ * pinch / rotate / nswipe 一次占用若干空闲 slot，所有手指的轨迹预计算在
+ * 同一张帧表里：按下一帧、每个周期一帧、抬起一帧，每帧同时更新全部手指，
+ * 帧内只写有变化的轴。tracking ID 在整个手势中保持不变。
+ */
+
+/** 多指手势类型 */
+enum mgesture_type {
+	MG_CIRCLE,	/* 手指均布在圆周上：pinch 改变半径，rotate 改变角度 */
+	MG_NSWIPE,	/* 手指横向排开，沿同一直线平移 */
+};
+
+/** 多指手势参数（UI 坐标） */
+struct mgesture {
+	enum mgesture_type type;	/* 手势类型 */
+	int fingers;				/* 手指数 */
+	double x1, y1;				/* MG_CIRCLE: 圆心；MG_NSWIPE: 起点中心 */
+	double x2, y2;				/* MG_NSWIPE: 终点中心 */
+	double r1, r2;				/* MG_CIRCLE: 起止半径 */
+	double a1, a2;				/* MG_CIRCLE: 起止角度（弧度） */
+	double spacing;				/* MG_NSWIPE: 相邻手指间距 */
+};
+
+/**
+ * @brief 计算第 f 指在 t 时刻的 UI 坐标
+ * @param g 手势参数
+ * @param f 手指序号
+ * @param t 归一化时间 [0, 1]
+ * @param x 输出 X
+ * @param y 输出 Y
+ */
+static void mgesture_point(const struct mgesture *g, int f, double t, double *x, double *y) {
+	if (g->type == MG_CIRCLE) {
+		double r = g->r1 + (g->r2 - g->r1) * t;
+		double a = g->a1 + (g->a2 - g->a1) * t + 2 * M_PI * f / g->fingers;
+		*x = g->x1 + r * cos(a);
+		*y = g->y1 + r * sin(a);
+	}
+	else {
+		double off = (f - (g->fingers - 1) / 2.0) * g->spacing;
+		*x = g->x1 + (g->x2 - g->x1) * t + off;
+		*y = g->y1 + (g->y2 - g->y1) * t;
+	}
+}
+
+/**
+ * @brief 执行一个多指手势
+ * @param td 触摸设备
+ * @param g 手势参数
+ * @param duration_ms 总时长（毫秒）
+ * @param steps 步数
+ * @param what 手势名称
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int mt_gesture(struct touch_dev *td, const struct mgesture *g, int duration_ms,
+					  int steps, const char *what) {
+	int slots[SLOTS_LIMIT];
+	int px[SLOTS_LIMIT], py[SLOTS_LIMIT];
+	struct traj tr;
+	int n = 0;
+
+	if (g->fingers < 1) {
+		fprintf(stderr, "%s: need at least one finger\n", what);
+		return RS_ERR;
+	}
+	for (int i = 0; i < td->nslots && n < g->fingers; i++) {
+		if (td->slots[i].tracking_id == 0)
+			slots[n++] = i;
+	}
+	if (n < g->fingers) {
+		fprintf(stderr, "%s: %d free slots needed, %d available\n", what, g->fingers, n);
+		return RS_ERR;
+	}
+
+	/* 预计算：每帧每指最多 slot、坐标和接触轴，另加一个 SYN_REPORT */
+	steps = gesture_steps(duration_ms, steps);
+	tr.frames = steps;
+	tr.ev = malloc(sizeof(*tr.ev) * steps * (n * (3 + CT_COUNT) + 1));
+	tr.off = malloc(sizeof(*tr.off) * (steps + 1));
+	if (!tr.ev || !tr.off) {
+		traj_free(&tr);
+		fprintf(stderr, "out of memory\n");
+		return RS_ERR;
+	}
+	for (int f = 0; f < n; f++) {
+		double x, y;
+		mgesture_point(g, f, 0, &x, &y);
+		px[f] = map_x(td, (int)floor(x + 0.5));
+		py[f] = map_y(td, (int)floor(y + 0.5));
+	}
+
+	/* 按下帧：所有手指同时落下 */
+	int ret = RS_OK;
+	if (td->active_touches == 0)
+		ret = write_event(td, EV_KEY, BTN_TOUCH, 1);
+	for (int f = 0; f < n && ret == RS_OK; f++) {
+		struct slot_state *ss = &td->slots[slots[f]];
+		double x, y;
+		mgesture_point(g, f, 0, &x, &y);
+		ss->tracking_id = alloc_tracking_id(td);
+		ss->x = map_x(td, (int)floor(x + 0.5));
+		ss->y = map_y(td, (int)floor(y + 0.5));
+		ss->dirty = 0;
+		td->active_touches++;
+		if (write_event(td, EV_ABS, ABS_MT_SLOT, slots[f]) == RS_ERR ||
+			write_event(td, EV_ABS, ABS_MT_TRACKING_ID, ss->tracking_id) == RS_ERR ||
+			write_event(td, EV_ABS, ABS_MT_POSITION_X, ss->x) == RS_ERR ||
+			write_event(td, EV_ABS, ABS_MT_POSITION_Y, ss->y) == RS_ERR ||
+			contact_write(td) == RS_ERR) {
+			ret = RS_ERR;
+		}
+	}
+	if (ret == RS_OK)
+		ret = syn(td);
+
+	/*
+	 * 帧表在按下帧之后生成，影子值从按下后的状态开始推进。
+	 * 手指按蛇形顺序写入（偶数帧逆序、奇数帧正序），相邻两帧衔接处
+	 * 不必再切换 slot。
+	 */
+	int k = 0;
+	for (int i = 0; ret == RS_OK && i < steps; i++) {
+		int start = k;
+		tr.off[i] = k;
+		for (int j = 0; j < n; j++) {
+			int f = (i % 2 == 0) ? n - 1 - j : j;
+			int *last = td->slots[slots[f]].mt_last;
+			struct input_event cev[CT_COUNT];
+			double x, y;
+			double t = (double)(i + 1) / steps;
+			mgesture_point(g, f, t, &x, &y);
+			int dx = map_x(td, (int)floor(x + 0.5));
+			int dy = map_y(td, (int)floor(y + 0.5));
+			px[f] = dx;
+			py[f] = dy;
+			int cx = shadow_update(&last[ABS_MT_POSITION_X - MT_CODE_FIRST], dx);
+			int cy = shadow_update(&last[ABS_MT_POSITION_Y - MT_CODE_FIRST], dy);
+			int nc = contact_put(td, last, cev, t);
+			if (!cx && !cy && !nc)
+				continue;
+			if (shadow_update(&td->cur_slot, slots[f]))
+				ev_set(&tr.ev[k++], EV_ABS, ABS_MT_SLOT, slots[f]);
+			if (cx)
+				ev_set(&tr.ev[k++], EV_ABS, ABS_MT_POSITION_X, dx);
+			if (cy)
+				ev_set(&tr.ev[k++], EV_ABS, ABS_MT_POSITION_Y, dy);
+			memcpy(&tr.ev[k], cev, sizeof(cev[0]) * nc);
+			k += nc;
+		}
+		if (k > start)
+			ev_set(&tr.ev[k++], EV_SYN, SYN_REPORT, 0);
+	}
+	tr.off[steps] = k;
+
+	if (ret == RS_OK)
+		ret = traj_play(td, &tr, duration_ms, what);
+	traj_free(&tr);
+
+	/* 抬起帧：无论中途是否失败都尝试松开所有手指 */
+	for (int f = 0; f < n; f++) {
+		struct slot_state *ss = &td->slots[slots[f]];
+		if (ss->tracking_id == 0)
+			continue;
+		ss->x = px[f];
+		ss->y = py[f];
+		ss->tracking_id = 0;
+		td->active_touches--;
+		write_event(td, EV_ABS, ABS_MT_SLOT, slots[f]);
+		write_event(td, EV_ABS, ABS_MT_TRACKING_ID, -1);
+	}
+	if (td->active_touches <= 0) {
+		td->active_touches = 0;
+		write_event(td, EV_KEY, BTN_TOUCH, 0);
+	}
+	if (syn(td) == RS_ERR) {
+		touch_cleanup(td);
+		ret = RS_ERR;
+	}
+	return ret;
+}
+
+/* ------------------ 退出信号 ------------------ */
+
+static volatile sig_atomic_t stop_flag = 0;	/* 收到 SIGINT/SIGTERM */
+static volatile sig_atomic_t dump_flag = 0;	/* 收到 SIGUSR1 */
+
+/**
+ * @brief 退出信号处理
+ * @param sig 信号编号
+ */
+static void on_stop_signal(int sig) {
+	(void)sig;
+	stop_flag = 1;
+}
+
+/**
+ * @brief SIGUSR1 处理：请求输出计数器
+ * @param sig 信号编号
+ */
+static void on_dump_signal(int sig) {
+	(void)sig;
+	dump_flag = 1;
+}
+
+/**
+ * @brief 安装 SIGINT/SIGTERM 处理，长时间运行的模式据此正常收尾
+ */
+static void install_stop_handlers(void) {
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_stop_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+/* ------------------ 录制 ------------------ */
+
+/*
+ * record 以只读方式打开真实设备，每次 read() 批量读取事件，编码后追加到
+ * 紧凑的二进制 trace 文件：
+ *
+ *   struct trace_header（含设备的轴信息和 slot 数）
+ *   事件记录 × N：varint(距上一事件的微秒数) u8(type) varint(code) zigzag-varint(value)
+ *
+ * 编码在主线程完成，写文件交给写线程：两块缓冲轮换，一块写盘时另一块
+ * 继续接收事件，读取路径上没有逐事件的 write()。
+ */
+
+#define TRACE_MAGIC		"MCAT"	/* trace 文件标识 */
+#define TRACE_VERSION	1		/* trace 格式版本 */
+
+/** trace 文件头（主机字节序） */
+struct trace_header {
+	char magic[4];					/* TRACE_MAGIC */
+	uint16_t version;				/* TRACE_VERSION */
+	uint16_t naxes;					/* 轴个数（录制时的 AXIS_COUNT） */
+	uint32_t nslots;				/* 录制设备的 slot 数 */
+	int32_t axes[AXIS_COUNT][4];	/* 每个轴：valid, min, max, res */
+};
+
+/** 双缓冲写盘 */
+struct rec_writer {
+	int fd;							/* trace 文件 */
+	unsigned char *buf[2];			/* 两块编码缓冲 */
+	size_t len[2];					/* 各缓冲的待写长度 */
+	int fill;						/* 主线程正在填充的缓冲 */
+	int pending;					/* 交给写线程、尚未写完的缓冲，-1 表示无 */
+	int done;						/* 主线程已结束 */
+	int error;						/* 写线程出错 */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/**
+ * @brief 编码一个无符号 varint
+ * @param p 输出位置
+ * @param v 值
+ * @return 写入的字节数
+ */
+static inline int varint_put(unsigned char *p, unsigned long long v) {
+	int n = 0;
+	while (v >= 0x80) {
+		p[n++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (unsigned char)v;
+	return n;
+}
+
+/**
+ * @brief 写线程：把交来的缓冲写入文件
+ * @param arg struct rec_writer
+ * @return NULL
+ */
+static void *rec_writer_thread(void *arg) {
+	struct rec_writer *w = arg;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (w->pending < 0 && !w->done)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (w->pending < 0)
+			break;
+		int b = w->pending;
+		pthread_mutex_unlock(&w->lock);
+
+		const unsigned char *p = w->buf[b];
+		size_t left = w->len[b];
+		int err = 0;
+		while (left > 0) {
+			ssize_t n = write(w->fd, p, left);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				err = 1;
+				break;
+			}
+			p += n;
+			left -= n;
+		}
+
+		pthread_mutex_lock(&w->lock);
+		w->len[b] = 0;
+		w->pending = -1;
+		w->error |= err;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/**
+ * @brief 把当前填充的缓冲交给写线程，并切换到另一块
+ * @param w 写盘状态
+ * @return RS_OK 成功，RS_ERR 写线程已出错
+ */
+static int rec_writer_swap(struct rec_writer *w) {
+	pthread_mutex_lock(&w->lock);
+	while (w->pending >= 0)
+		pthread_cond_wait(&w->cond, &w->lock);
+	if (w->len[w->fill] > 0) {
+		w->pending = w->fill;
+		w->fill ^= 1;
+		pthread_cond_broadcast(&w->cond);
+	}
+	int err = w->error;
+	pthread_mutex_unlock(&w->lock);
+	return err ? RS_ERR : RS_OK;
+}
+
+/**
+ * @brief 录制设备事件到 trace 文件
+ * @param dev 输入设备路径
+ * @param out trace 文件路径
+ * @param seconds 录制时长（秒），0 表示直到收到 SIGINT/SIGTERM
+ * @param grab 是否独占设备（录制期间事件不再送达其他读者）
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int record(const char *dev, const char *out, int seconds, int grab) {
+	struct input_event ev[RECORD_BATCH];
+	struct axis_info axes[AXIS_COUNT];
+	struct trace_header hdr;
+	struct rec_writer w;
+	pthread_t tid;
+	long long last_us = -1;
+	long long end = seconds > 0 ? mono_ns() + seconds * 1000000000LL : 0;
+	unsigned long events = 0, dropped = 0;
+	int clk = CLOCK_MONOTONIC;
+	int ret = RS_OK;
+
+	int fd = open(dev, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "open %s failed: %s\n", dev, strerror(errno));
+		return RS_ERR;
+	}
+	/* 单调时钟的时间戳不受 NTP 调整影响 */
+	dev_ioctl(fd, EVIOCSCLOCKID, &clk);
+	if (grab)
+		dev_ioctl(fd, EVIOCGRAB, 1);
+
+	memset(&w, 0, sizeof(w));
+	w.fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	w.pending = -1;
+	w.buf[0] = malloc(RECORD_BUF_SIZE);
+	w.buf[1] = malloc(RECORD_BUF_SIZE);
+	if (w.fd < 0 || !w.buf[0] || !w.buf[1]) {
+		if (w.fd < 0)
+			fprintf(stderr, "open %s failed: %s\n", out, strerror(errno));
+		else
+			fprintf(stderr, "out of memory\n");
+		ret = RS_ERR;
+		goto out_close;
+	}
+
+	axis_cache_read(fd, axes);
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, 4);
+	hdr.version = TRACE_VERSION;
+	hdr.naxes = AXIS_COUNT;
+	hdr.nslots = axes[AXIS_SLOT].valid ? axes[AXIS_SLOT].max + 1 : 1;
+	for (int i = 0; i < AXIS_COUNT; i++) {
+		hdr.axes[i][0] = axes[i].valid;
+		hdr.axes[i][1] = axes[i].min;
+		hdr.axes[i][2] = axes[i].max;
+		hdr.axes[i][3] = axes[i].res;
+	}
+	memcpy(w.buf[0], &hdr, sizeof(hdr));
+	w.len[0] = sizeof(hdr);
+
+	pthread_mutex_init(&w.lock, NULL);
+	pthread_cond_init(&w.cond, NULL);
+	if (pthread_create(&tid, NULL, rec_writer_thread, &w) != 0) {
+		fprintf(stderr, "pthread_create failed\n");
+		ret = RS_ERR;
+		goto out_close;
+	}
+
+	install_stop_handlers();
+	while (!stop_flag && ret == RS_OK) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int timeout = -1;
+		if (end) {
+			long long left = end - mono_ns();
+			if (left <= 0)
+				break;
+			timeout = (int)(left / 1000000) + 1;
+		}
+		if (poll(&pfd, 1, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = RS_ERR;
+			break;
+		}
+		if (!(pfd.revents & POLLIN))
+			continue;
+
+		ssize_t n = read(fd, ev, sizeof(ev));
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			fprintf(stderr, "read %s failed: %s\n", dev, strerror(errno));
+			ret = RS_ERR;
+			break;
+		}
+		if (n == 0)
+			break;
+
+		for (int i = 0; i < (int)(n / sizeof(ev[0])); i++) {
+			long long us = (long long)ev[i].time.tv_sec * 1000000 + ev[i].time.tv_usec;
+			long long delta = last_us < 0 || us < last_us ? 0 : us - last_us;
+			last_us = us;
+			if (ev[i].type == EV_SYN && ev[i].code == SYN_DROPPED)
+				dropped++;
+
+			if (w.len[w.fill] + RECORD_MAX_REC > RECORD_BUF_SIZE &&
+				rec_writer_swap(&w) == RS_ERR) {
+				ret = RS_ERR;
+				break;
+			}
+			unsigned char *p = w.buf[w.fill] + w.len[w.fill];
+			int k = varint_put(p, (unsigned long long)delta);
+			p[k++] = (unsigned char)ev[i].type;
+			k += varint_put(p + k, ev[i].code);
+			k += varint_put(p + k, ((unsigned int)ev[i].value << 1) ^ (unsigned int)(ev[i].value >> 31));
+			w.len[w.fill] += k;
+			events++;
+		}
+	}
+
+	/* 交出最后一块缓冲并等待写线程结束 */
+	if (rec_writer_swap(&w) == RS_ERR)
+		ret = RS_ERR;
+	pthread_mutex_lock(&w.lock);
+	while (w.pending >= 0)
+		pthread_cond_wait(&w.cond, &w.lock);
+	w.done = 1;
+	pthread_cond_broadcast(&w.cond);
+	pthread_mutex_unlock(&w.lock);
+	pthread_join(tid, NULL);
+	if (w.error) {
+		fprintf(stderr, "write %s failed\n", out);
+		ret = RS_ERR;
+	}
+	fprintf(stderr, "recorded %lu events, %lu SYN_DROPPED\n", events, dropped);
+
+out_close:
+	if (w.fd >= 0)
+		close(w.fd);
+	free(w.buf[0]);
+	free(w.buf[1]);
+	close(fd);
+	return ret;
+}
+
+/* ------------------ 回放 ------------------ */
+
+/*
+ * replay 用 mmap 映射 trace 文件，直接在映射上解码事件，没有逐事件的
+ * read() 和内存分配。每帧按其第一个事件的原始相对时间戳换算成绝对截止
+ * 时间（除以 --speed），由 sleep_until() 等待后整帧提交。
+ * 录制设备与目标设备的坐标范围不同时，位置轴按 --map 的同一套定点映射
+ * 换算：以录制设备的范围作为逻辑尺寸映射到目标设备。
+ */
+
+/** 回放时的坐标换算 */
+struct replay_map {
+	int rmin;				/* 录制设备的最小值 */
+	struct axis_map m;		/* 从 (v - rmin) 到目标设备坐标 */
+};
+
+/**
+ * @brief 解码一个无符号 varint
+ * @param p 读取位置（前移）
+ * @param end 数据末尾
+ * @param v 输出值
+ * @return RS_OK 成功，RS_ERR 数据被截断
+ */
+static inline int varint_get(const unsigned char **p, const unsigned char *end,
+							 unsigned long long *v) {
+	unsigned long long r = 0;
+	int shift = 0;
+
+	while (*p < end && shift < 64) {
+		unsigned char b = *(*p)++;
+		r |= (unsigned long long)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*v = r;
+			return RS_OK;
+		}
+		shift += 7;
+	}
+	return RS_ERR;
+}
+
+/**
+ * @brief 计算一个位置轴的回放换算
+ * @param rm 输出的换算
+ * @param rec 录制设备的轴信息 {valid, min, max, res}
+ * @param dst 目标设备的轴信息
+ */
+static void replay_map_init(struct replay_map *rm, const int32_t *rec,
+							const struct axis_info *dst) {
+	rm->rmin = 0;
+	rm->m.base = 0;
+	rm->m.scale = 0;
+	if (!rec[0] || !dst->valid || rec[2] <= rec[1] ||
+		(rec[1] == dst->min && rec[2] == dst->max))
+		return;
+	rm->rmin = rec[1];
+	axis_map_init(&rm->m, dst, dst, rec[2] - rec[1]);
+}
+
+/**
+ * @brief 按换算调整一个坐标
+ * @param rm 换算，scale 为 0 表示不换算
+ * @param v 录制坐标
+ * @return 目标设备坐标
+ */
+static inline int replay_map_apply(const struct replay_map *rm, int v) {
+	return rm->m.scale ? axis_map_apply(&rm->m, v - rm->rmin) : v;
+}
+
+/**
+ * @brief 按原始节奏回放 trace 文件
+ * @param td 触摸设备
+ * @param path trace 文件路径
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int replay(struct touch_dev *td, const char *path) {
+	struct replay_map rx, ry;
+	struct stat st;
+	int ret = RS_OK;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "open %s failed: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return RS_ERR;
+	}
+	if ((size_t)st.st_size < offsetof(struct trace_header, axes)) {
+		fprintf(stderr, "%s: not a trace file\n", path);
+		close(fd);
+		return RS_ERR;
+	}
+	const unsigned char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "mmap %s failed: %s\n", path, strerror(errno));
+		return RS_ERR;
+	}
+	madvise((void *)base, st.st_size, MADV_SEQUENTIAL);
+
+	/* 轴表只会在末尾追加，旧文件的 naxes 较小，头部随之变短 */
+	const struct trace_header *hdr = (const struct trace_header *)base;
+	size_t hdr_len = offsetof(struct trace_header, axes) + (size_t)hdr->naxes * sizeof(hdr->axes[0]);
+	if (memcmp(hdr->magic, TRACE_MAGIC, 4) != 0 || hdr->version != TRACE_VERSION ||
+		hdr->naxes <= AXIS_MT_Y || hdr->naxes > AXIS_COUNT || hdr_len > (size_t)st.st_size) {
+		fprintf(stderr, "%s: unsupported trace format\n", path);
+		munmap((void *)base, st.st_size);
+		return RS_ERR;
+	}
+
+	/* X/Y 与 MT X/Y 使用各自的范围 */
+	struct replay_map rmx, rmy;
+	replay_map_init(&rx, hdr->axes[AXIS_X], &td->axes[AXIS_X]);
+	replay_map_init(&ry, hdr->axes[AXIS_Y], &td->axes[AXIS_Y]);
+	replay_map_init(&rmx, hdr->axes[AXIS_MT_X], &td->axes[AXIS_MT_X]);
+	replay_map_init(&rmy, hdr->axes[AXIS_MT_Y], &td->axes[AXIS_MT_Y]);
+
+	const unsigned char *p = base + hdr_len;
+	const unsigned char *end = base + st.st_size;
+	double ns_per_us = speed > 0 ? 1000.0 / speed : 0;
+	/* SIGINT/SIGTERM 只置 stop_flag，由下面的循环收尾抬起触点 */
+	install_stop_handlers();
+	long long t0 = mono_ns();
+	long long ts = 0;		/* 当前事件相对第一个事件的时间（微秒） */
+	int frame_open = 0;
+
+	while (p < end && !stop_flag) {
+		unsigned long long delta, code, zz;
+		if (varint_get(&p, end, &delta) == RS_ERR || p >= end)
+			break;
+		unsigned int type = *p++;
+		if (varint_get(&p, end, &code) == RS_ERR || varint_get(&p, end, &zz) == RS_ERR)
+			break;
+		int value = (int)((unsigned int)(zz >> 1) ^ -(unsigned int)(zz & 1));
+		ts += (long long)delta;
+
+		/* 每帧的第一个事件决定整帧的发出时刻 */
+		if (!frame_open) {
+			if (ns_per_us > 0)
+				sleep_until(t0 + (long long)(ts * ns_per_us));
+			frame_open = 1;
+		}
+
+		if (type == EV_SYN) {
+			if (code == SYN_REPORT) {
+				if (syn(td) == RS_ERR) {
+					ret = RS_ERR;
+					break;
+				}
+				frame_open = 0;
+			}
+			else if (code == SYN_MT_REPORT && syn_mt(td) == RS_ERR) {
+				ret = RS_ERR;
+				break;
+			}
+			/* SYN_DROPPED 等只对读端有意义，不回放 */
+			continue;
+		}
+		if (type == EV_ABS) {
+			if (code == ABS_X)
+				value = replay_map_apply(&rx, value);
+			else if (code == ABS_Y)
+				value = replay_map_apply(&ry, value);
+			else if (code == ABS_MT_POSITION_X)
+				value = replay_map_apply(&rmx, value);
+			else if (code == ABS_MT_POSITION_Y)
+				value = replay_map_apply(&rmy, value);
+		}
+		if (write_event(td, (__u16)type, (__u16)code, value) == RS_ERR) {
+			ret = RS_ERR;
+			break;
+		}
+	}
+	/* trace 末尾不完整的帧丢弃；失败或被中断时抬起录制中按下的触点 */
+	td->frame_len = 0;
+	td->frame_done = 0;
+	if (ret == RS_ERR || stop_flag)
+		touch_cleanup(td);
+
+	munmap((void *)base, st.st_size);
+	return ret;
+}
+
+/* ------------------ 编译回放 ------------------ */
+
+/*
+ * compile 在虚拟时钟上执行一个脚本，把写往设备的每一批事件连同其截止时间
+ * 保存为编译文件，映射、轨迹计算和增量抑制都已完成：
+ *
+ *   struct compiled_header（含编译时设备的轴信息）
+ *   struct compiled_frame × nframes
+ *   对齐到页边界的 struct input_event × nevents
+ *
+ * play 用 mmap 映射文件，事件区直接交给 write()：内核从页缓存拷贝到输入
+ * 子系统，用户态不再复制、解析或计算。截止时间相同或已经过去的相邻批次
+ * 合并为一次 write()。文件只适用于轴范围相同的设备，play 时会检查。
+ */
+
+#define COMPILED_MAGIC		"MCAC"	/* 编译文件标识 */
+#define COMPILED_VERSION	2		/* 编译文件格式版本 */
+
+/** 编译文件头 */
+struct compiled_header {
+	char magic[4];					/* COMPILED_MAGIC */
+	uint16_t version;				/* COMPILED_VERSION */
+	uint16_t naxes;					/* 轴个数（AXIS_COUNT） */
+	uint32_t nframes;				/* 批次数 */
+	uint32_t nevents;				/* 事件数 */
+	uint32_t ev_offset;				/* 事件区在文件中的偏移（页对齐） */
+	uint32_t ev_size;				/* sizeof(struct input_event)，随 ABI 不同 */
+	int32_t axes[AXIS_COUNT][4];	/* 每个轴：valid, min, max, res */
+};
+
+/**
+ * @brief 打上时间戳后写出编译文件中的批次 [i, j)
+ *
+ * 映射保持只读：按批次边界把事件复制到帧缓冲，凑满一次缓冲写一次。单个批次
+ * 超过缓冲容量（只可能来自损坏的文件）时直接从映射写出，不打时间戳。
+ * @param td 触摸设备
+ * @param ev 事件区
+ * @param f 批次表
+ * @param i 第一个批次
+ * @param j 结束批次（不含），批次在事件区中连续
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int play_stamped(struct touch_dev *td, const struct input_event *ev,
+						const struct compiled_frame *f, uint32_t i, uint32_t j) {
+	while (i < j) {
+		uint32_t k = i;
+		int n = 0;
+		while (k < j && f[k].count <= (uint32_t)(FRAME_EVENTS - n))
+			n += f[k++].count;
+		if (k == i) {
+			if (write_frames(td, ev + f[i].first, f[i].count) == RS_ERR)
+				return RS_ERR;
+			i++;
+			continue;
+		}
+		memcpy(td->frame, ev + f[i].first, sizeof(*ev) * n);
+		frames_stamp(td, td->frame, n);
+		if (write_frames(td, td->frame, n) == RS_ERR)
+			return RS_ERR;
+		i = k;
+	}
+	return RS_OK;
+}
+
+/**
+ * @brief 执行编译文件
+ * @param td 触摸设备
+ * @param path 编译文件路径
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int play(struct touch_dev *td, const char *path) {
+	struct stat st;
+	int ret = RS_OK;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "open %s failed: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return RS_ERR;
+	}
+	if ((size_t)st.st_size < sizeof(struct compiled_header)) {
+		fprintf(stderr, "%s: not a compiled file\n", path);
+		close(fd);
+		return RS_ERR;
+	}
+	const unsigned char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "mmap %s failed: %s\n", path, strerror(errno));
+		return RS_ERR;
+	}
+
+	/* 计数用除法与剩余长度比较，32 位目标上乘法会溢出 */
+	const struct compiled_header *hdr = (const struct compiled_header *)base;
+	if (memcmp(hdr->magic, COMPILED_MAGIC, 4) != 0 || hdr->version != COMPILED_VERSION ||
+		hdr->naxes != AXIS_COUNT || hdr->ev_size != sizeof(struct input_event) ||
+		hdr->ev_offset < sizeof(*hdr) || hdr->ev_offset > (size_t)st.st_size ||
+		hdr->nframes > (hdr->ev_offset - sizeof(*hdr)) / sizeof(struct compiled_frame) ||
+		hdr->nevents > ((size_t)st.st_size - hdr->ev_offset) / hdr->ev_size) {
+		fprintf(stderr, "%s: unsupported compiled file\n", path);
+		munmap((void *)base, st.st_size);
+		return RS_ERR;
+	}
+	for (int i = 0; i < AXIS_COUNT; i++) {
+		const struct axis_info *ax = &td->axes[i];
+		if (hdr->axes[i][0] != ax->valid ||
+			(ax->valid && (hdr->axes[i][1] != ax->min || hdr->axes[i][2] != ax->max))) {
+			fprintf(stderr, "%s: compiled for a device with different axis ranges\n", path);
+			munmap((void *)base, st.st_size);
+			return RS_ERR;
+		}
+	}
+
+	const struct compiled_frame *f = (const struct compiled_frame *)(hdr + 1);
+	const struct input_event *ev = (const struct input_event *)(base + hdr->ev_offset);
+	madvise((void *)ev, (size_t)hdr->nevents * hdr->ev_size, MADV_WILLNEED);
+
+	/* 文件中的事件绕过了影子值，开始和结束时都作废 */
+	int stamp = stamp_wanted(td);
+	delta_reset(td);
+	/* SIGINT/SIGTERM 只置 stop_flag，由下面的循环收尾抬起触点 */
+	install_stop_handlers();
+	long long t0 = mono_ns();
+	for (uint32_t i = 0; i < hdr->nframes && !stop_flag; ) {
+		long long deadline = t0 + (speed > 0 ? (long long)(f[i].offset_ns / speed) : 0);
+		uint32_t j = i + 1;
+		sleep_until(deadline);
+		/* 合并同一时刻或已到期、在事件区中连续的批次 */
+		long long now = mono_ns();
+		while (j < hdr->nframes && f[j].first == (uint64_t)f[j - 1].first + f[j - 1].count &&
+			   t0 + (speed > 0 ? (long long)(f[j].offset_ns / speed) : 0) <= now)
+			j++;
+		uint64_t end = (uint64_t)f[j - 1].first + f[j - 1].count;
+		if (end > hdr->nevents) {
+			fprintf(stderr, "%s: batch %u out of range\n", path, i);
+			ret = RS_ERR;
+			break;
+		}
+		int n = (int)(end - f[i].first);
+		if ((stamp ? play_stamped(td, ev, f, i, j) : write_frames(td, ev + f[i].first, n)) == RS_ERR) {
+			ret = RS_ERR;
+			break;
+		}
+		i = j;
+	}
+	delta_reset(td);
+	if (ret == RS_ERR || stop_flag)
+		touch_cleanup(td);
+
+	munmap((void *)base, st.st_size);
+	return ret;
+}
+
+/* ------------------ 压力测试 ------------------ */
+
+/*
+ * stress 按固定帧率持续生成随机但合法的触摸序列：每帧以一定概率在空闲
+ * slot 按下一指（点击、快速滑动或慢速拖动三种，各有随机的寿命和速度），
+ * 寿命到的手指抬起，其余移动中的手指在同一帧内更新，碰到边缘反弹。
+ * 一帧内的抬起、按下和移动经 burst 合并为一次写出，状态全部在栈上，
+ * 循环中不分配内存。随机数用 xorshift64*，种子在开始时输出，失败后用
+ * 同一种子（和同样的 --slots、--map）可以重放完全相同的序列。
+ */
+
+/** stress 中一个手指的状态（UI 坐标） */
+struct stress_finger {
+	int life;		/* 剩余帧数，0 表示未按下 */
+	int x, y;		/* 当前位置 */
+	int vx, vy;		/* 每帧位移 */
+};
+
+/**
+ * @brief xorshift64* 随机数
+ * @param s 状态（非 0）
+ * @return 64 位随机数
+ */
+static inline uint64_t xrand(uint64_t *s) {
+	uint64_t x = *s;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*s = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * @brief 取 [0, n) 内的随机整数
+ * @param s 状态
+ * @param n 上界（> 0）
+ * @return 随机整数
+ */
+static inline int xrand_below(uint64_t *s, int n) {
+	return (int)(((xrand(s) >> 32) * (uint64_t)n) >> 32);
+}
+
+/**
+ * @brief 计算一个方向的 UI 坐标范围
+ * @param m 该方向的映射参数
+ * @param ax 设备轴（无效时用 fallback）
+ * @param fallback 备用轴
+ * @param lo 输出的最小值
+ * @param hi 输出的最大值
+ */
+static void stress_extent(const struct axis_map *m, const struct axis_info *ax,
+						  const struct axis_info *fallback, int *lo, int *hi) {
+	if (!ax->valid)
+		ax = fallback;
+	*lo = 0;
+	*hi = ax->valid ? ax->max : SCREEN_W - 1;
+	if (m->scale) {
+		*hi = (int)(((long long)(ax->max - m->base) << 16) / m->scale);
+	} else if (ax->valid) {
+		*lo = ax->min;
+	}
+	if (*hi <= *lo)
+		*hi = *lo + 1;
+}
+
+/**
+ * @brief 随机压力测试
+ * @param td 触摸设备
+ * @param seconds 运行时长（秒），0 表示直到 SIGINT/SIGTERM
+ * @param rate_hz 帧率
+ * @param fingers 最多同时按下的手指数
+ * @param seed 随机种子，0 表示取当前时间
+ * @return RS_OK 成功，RS_ERR 写入失败
+ */
+static int stress(struct touch_dev *td, int seconds, int rate_hz, int fingers,
+				  unsigned long long seed) {
+	struct stress_finger fs[SLOTS_LIMIT];
+	struct slot_update u[SLOTS_LIMIT];
+	int xlo, xhi, ylo, yhi;
+	unsigned long downs = 0, ups = 0, wraps = 0;
+	long long frames = 0;
+	int down = 0;
+	int ret = RS_OK;
+
+	if (rate_hz <= 0)
+		rate_hz = STRESS_RATE_HZ;
+	if (fingers <= 0 || fingers > td->nslots)
+		fingers = td->nslots;
+	if (!seed)
+		seed = (unsigned long long)mono_ns() ^ ((unsigned long long)getpid() << 32);
+	uint64_t rs = seed;
+	stress_extent(&td->map_x, &td->axes[AXIS_MT_X], &td->axes[AXIS_X], &xlo, &xhi);
+	stress_extent(&td->map_y, &td->axes[AXIS_MT_Y], &td->axes[AXIS_Y], &ylo, &yhi);
+	fprintf(stderr, "stress: seed %llu, %d Hz, up to %d fingers\n", seed, rate_hz, fingers);
+
+	/* 开始前已经按下的 slot 不参与 */
+	memset(fs, 0, sizeof(fs));
+	install_stop_handlers();
+	long long period = 1000000000LL / rate_hz;
+	long long t0 = mono_ns();
+	long long end = seconds > 0 ? t0 + seconds * 1000000000LL : 0;
+
+	while (!stop_flag && ret == RS_OK && (!end || t0 + frames * period < end)) {
+		burst_begin(td);
+
+		/* 寿命到的手指抬起 */
+		for (int s = 0; s < td->nslots && ret == RS_OK; s++) {
+			if (fs[s].life > 0 && --fs[s].life == 0) {
+				ret = mt_up(td, s);
+				down--;
+				ups++;
+			}
+		}
+
+		/* 按概率在随机的空闲 slot 按下一指 */
+		int slot = -1;
+		if (ret == RS_OK && down < fingers && xrand_below(&rs, 100) < STRESS_SPAWN_PCT) {
+			slot = xrand_below(&rs, td->nslots);
+			for (int k = 0; k < td->nslots && td->slots[slot].tracking_id != 0; k++)
+				slot = (slot + 1) % td->nslots;
+			if (td->slots[slot].tracking_id != 0)
+				slot = -1;
+		}
+		if (slot >= 0) {
+			struct stress_finger *f = &fs[slot];
+			int kind = xrand_below(&rs, 3);
+			int vmax = kind == 1 ? (xhi - xlo) / 40 + 1 : 2;
+			f->x = xlo + xrand_below(&rs, xhi - xlo + 1);
+			f->y = ylo + xrand_below(&rs, yhi - ylo + 1);
+			f->vx = kind ? xrand_below(&rs, 2 * vmax + 1) - vmax : 0;
+			f->vy = kind ? xrand_below(&rs, 2 * vmax + 1) - vmax : 0;
+			f->life = kind == 0 ? 1 + xrand_below(&rs, 5) :
+				kind == 1 ? 5 + xrand_below(&rs, 100) : 20 + xrand_below(&rs, 500);
+			int tid = td->next_tracking_id;
+			ret = mt_down(td, slot, f->x, f->y);
+			if (td->next_tracking_id < tid)
+				wraps++;
+			down++;
+			downs++;
+		}
+
+		/* 其余手指移动，碰到边缘反弹 */
+		int n = 0;
+		for (int s = 0; s < td->nslots && ret == RS_OK; s++) {
+			struct stress_finger *f = &fs[s];
+			if (f->life == 0 || (f->vx == 0 && f->vy == 0))
+				continue;
+			f->x += f->vx;
+			f->y += f->vy;
+			if (f->x < xlo || f->x > xhi) {
+				f->vx = -f->vx;
+				f->x = f->x < xlo ? xlo : xhi;
+			}
+			if (f->y < ylo || f->y > yhi) {
+				f->vy = -f->vy;
+				f->y = f->y < ylo ? ylo : yhi;
+			}
+			u[n++] = (struct slot_update){ s, f->x, f->y };
+		}
+		if (ret == RS_OK && n > 0)
+			ret = mt_frame(td, u, n);
+
+		if (burst_end(td, ret == RS_OK) == RS_ERR)
+			ret = RS_ERR;
+		frames++;
+		sleep_until(t0 + frames * period);
+	}
+
+	/* 收尾：抬起仍按下的手指 */
+	if (ret == RS_ERR) {
+		touch_cleanup(td);
+	} else {
+		burst_begin(td);
+		for (int s = 0; s < td->nslots && ret == RS_OK; s++) {
+			if (fs[s].life > 0) {
+				ret = mt_up(td, s);
+				ups++;
+			}
+		}
+		if (burst_end(td, ret == RS_OK) == RS_ERR) {
+			touch_cleanup(td);
+			ret = RS_ERR;
+		}
+	}
+	fprintf(stderr, "stress: seed %llu, %lld frames, %lu downs, %lu ups, %lu tracking-id wraps%s\n",
+			seed, frames, downs, ups, wraps, ret == RS_ERR ? ", failed" : "");
+	return ret;
+}
+
+/* ------------------ 回环延迟 ------------------ */
+
+/*
+ * latency 在 --uinput 创建的虚拟设备上测量端到端延迟：找到内核为其生成的
+ * /dev/input/eventN，由读线程打开并读取，主线程按固定间隔注入帧，每帧的
+ * ABS_X 值编码帧序号。每帧记录三个时间点：write() 前（注入）、内核时间戳
+ * （EVIOCSCLOCKID 设为单调时钟）、读线程 read() 返回（送达），由此区分
+ * 注入路径和读端调度的耗时。读端与合成器一样是普通 evdev 读者，--grab
+ * 时独占该节点，合成器不会收到这些帧。
+ */
+
+/** 回环测量状态 */
+struct latency_ctx {
+	int fd;					/* 读端 evdev 文件描述符 */
+	int frames;				/* 注入帧数 */
+	int xmin;				/* ABS_X 最小值 */
+	int xrange;				/* 用于编码序号的 ABS_X 取值个数 */
+	long long *sent;		/* 每帧 write() 前的时间（纳秒） */
+	long long *stamp;		/* 每帧的内核时间戳（纳秒），-1 未收到 */
+	long long *recv;		/* 每帧 read() 返回的时间（纳秒） */
+	int received;			/* 已收到的帧数 */
+	int dropped;			/* SYN_DROPPED 次数 */
+	volatile int done;		/* 注入结束且等待期已过 */
+};
+
+/**
+ * @brief 帧序号对应的 ABS_X 值
+ * @param lc 测量状态
+ * @param seq 帧序号
+ * @return ABS_X 值
+ */
+static inline int latency_value(const struct latency_ctx *lc, int seq) {
+	/* 相邻两帧的值总不相同，且首帧不等于轴初值，不会被增量抑制或内核去重吞掉 */
+	return lc->xmin + (seq + 1) % lc->xrange;
+}
+
+/**
+ * @brief 查找虚拟设备对应的 evdev 节点
+ * @param td 虚拟设备
+ * @param buf 输出路径
+ * @param len 缓冲长度
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int latency_find_node(struct touch_dev *td, char *buf, size_t len) {
+	char sysname[64], dir[128];
+	struct dirent *de;
+	DIR *d;
+
+	if (dev_ioctl(td->fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+		fprintf(stderr, "UI_GET_SYSNAME failed: %s\n", strerror(errno));
+		return RS_ERR;
+	}
+	snprintf(dir, sizeof(dir), "/sys/devices/virtual/input/%s", sysname);
+	d = opendir(dir);
+	if (!d) {
+		fprintf(stderr, "open %s failed: %s\n", dir, strerror(errno));
+		return RS_ERR;
+	}
+	while ((de = readdir(d)) != NULL) {
+		if (strncmp(de->d_name, "event", 5) == 0) {
+			snprintf(buf, len, "/dev/input/%s", de->d_name);
+			closedir(d);
+			return RS_OK;
+		}
+	}
+	closedir(d);
+	fprintf(stderr, "no event node under %s\n", dir);
+	return RS_ERR;
+}
+
+/**
+ * @brief 读线程：按 ABS_X 值认领帧并记录时间
+ */
+static void *latency_reader(void *arg) {
+	struct latency_ctx *lc = arg;
+	struct input_event ev[RECORD_BATCH];
+	int next = 0;		/* 下一个期望的帧序号 */
+	int seq = -1;		/* 当前帧认领到的序号 */
+
+	while (!lc->done) {
+		struct pollfd pfd = { lc->fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 10) <= 0 || !(pfd.revents & POLLIN))
+			continue;
+		ssize_t n = read(lc->fd, ev, sizeof(ev));
+		long long now = mono_ns();
+		if (n <= 0)
+			continue;
+
+		for (int i = 0; i < (int)(n / sizeof(ev[0])); i++) {
+			if (ev[i].type == EV_ABS && ev[i].code == ABS_X && next < lc->frames) {
+				/* 丢帧时向前跳到值相符的序号 */
+				int skip = (ev[i].value - latency_value(lc, next) + lc->xrange) % lc->xrange;
+				seq = next + skip < lc->frames ? next + skip : -1;
+			}
+			else if (ev[i].type == EV_SYN && ev[i].code == SYN_DROPPED) {
+				lc->dropped++;
+			}
+			else if (ev[i].type == EV_SYN && ev[i].code == SYN_REPORT && seq >= 0) {
+				lc->stamp[seq] = (long long)ev[i].time.tv_sec * 1000000000LL +
+					ev[i].time.tv_usec * 1000LL;
+				lc->recv[seq] = now;
+				lc->received++;
+				next = seq + 1;
+				seq = -1;
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief 输出延迟分布（对数分桶直方图）
+ * @param name 名称
+ * @param v 样本（纳秒，会被排序）
+ * @param n 样本数
+ */
+static void latency_report(const char *name, long long *v, int n) {
+	int hist[LATENCY_BUCKETS] = { 0 };
+	int peak = 1;
+
+	if (n == 0)
+		return;
+	for (int i = 0; i < n; i++) {
+		long long us = v[i] / 1000;
+		int b = 0;
+		while (us > 0 && b < LATENCY_BUCKETS - 1) {
+			us >>= 1;
+			b++;
+		}
+		hist[b]++;
+	}
+	for (int b = 0; b < LATENCY_BUCKETS; b++) {
+		if (hist[b] > peak)
+			peak = hist[b];
+	}
+	qsort(v, n, sizeof(v[0]), latency_cmp);
+	printf("%s: p50 %lld us, p99 %lld us, max %lld us\n", name,
+		   v[n / 2] / 1000, v[(int)((long long)n * 99 / 100)] / 1000, v[n - 1] / 1000);
+	for (int b = 0; b < LATENCY_BUCKETS; b++) {
+		if (!hist[b])
+			continue;
+		if (b == 0)
+			printf("  %7s < %6d us %7d ", "", 1, hist[b]);
+		else if (b == LATENCY_BUCKETS - 1)
+			printf("  %7d+          %7d ", 1 << (b - 1), hist[b]);
+		else
+			printf("  %7d - %6d us %7d ", 1 << (b - 1), 1 << b, hist[b]);
+		for (int k = 0; k < hist[b] * 40 / peak; k++)
+			putchar('#');
+		putchar('\n');
+	}
+}
+
+/**
+ * @brief 端到端回环延迟测量
+ * @param td 虚拟设备（必须由 --uinput 创建）
+ * @param frames 注入帧数
+ * @param interval_us 帧间隔（微秒）
+ * @param grab 是否独占读端节点
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int latency(struct touch_dev *td, int frames, int interval_us, int grab) {
+	struct latency_ctx lc;
+	pthread_t tid;
+	char node[PATH_MAX];
+	int clk = CLOCK_MONOTONIC;
+	int ret = RS_ERR;
+
+	if (!td->is_uinput) {
+		fprintf(stderr, "latency requires --uinput\n");
+		return RS_ERR;
+	}
+	if (frames < 1)
+		frames = LATENCY_FRAMES;
+	if (latency_find_node(td, node, sizeof(node)) == RS_ERR)
+		return RS_ERR;
+
+	memset(&lc, 0, sizeof(lc));
+	lc.frames = frames;
+	lc.xmin = td->axes[AXIS_X].min;
+	lc.xrange = td->axes[AXIS_X].max - td->axes[AXIS_X].min + 1;
+	if (lc.xrange < 2)
+		lc.xrange = 2;
+	lc.sent = malloc(sizeof(long long) * frames);
+	lc.stamp = malloc(sizeof(long long) * frames);
+	lc.recv = malloc(sizeof(long long) * frames);
+	lc.fd = open(node, O_RDONLY | O_NONBLOCK);
+	if (!lc.sent || !lc.stamp || !lc.recv || lc.fd < 0) {
+		fprintf(stderr, "open %s failed: %s\n", node, strerror(errno));
+		goto out;
+	}
+	for (int i = 0; i < frames; i++)
+		lc.stamp[i] = -1;
+	dev_ioctl(lc.fd, EVIOCSCLOCKID, &clk);
+	if (grab)
+		dev_ioctl(lc.fd, EVIOCGRAB, 1);
+
+	if (pthread_create(&tid, NULL, latency_reader, &lc) != 0) {
+		fprintf(stderr, "pthread_create failed\n");
+		goto out;
+	}
+
+	/* 起始帧按下，之后每帧只改 ABS_X */
+	ret = do_press(td, 0, 0);
+	long long deadline = mono_ns();
+	for (int i = 0; i < frames && ret == RS_OK; i++) {
+		deadline += interval_us * 1000LL;
+		sleep_until(deadline);
+		lc.sent[i] = mono_ns();
+		if (write_event(td, EV_ABS, ABS_X, latency_value(&lc, i)) == RS_ERR ||
+			syn(td) == RS_ERR)
+			ret = RS_ERR;
+	}
+	if (do_release(td) == RS_ERR)
+		ret = RS_ERR;
+
+	/* 给最后几帧留出送达时间 */
+	sleep_until(mono_ns() + LATENCY_DRAIN_MS * 1000000LL);
+	lc.done = 1;
+	pthread_join(tid, NULL);
+
+	/* 只统计收到的帧，原地压缩为三组差值 */
+	int n = 0;
+	for (int i = 0; i < frames; i++) {
+		if (lc.stamp[i] < 0)
+			continue;
+		long long total = lc.recv[i] - lc.sent[i];
+		long long inject = lc.stamp[i] - lc.sent[i];
+		lc.recv[n] = total;
+		lc.stamp[n] = lc.recv[n] - (inject > 0 ? inject : 0);	/* 送达 */
+		lc.sent[n] = inject > 0 ? inject : 0;					/* 注入 */
+		n++;
+	}
+	printf("latency: %d frames sent, %d received, %d SYN_DROPPED, interval %d us, node %s\n",
+		   frames, lc.received, lc.dropped, interval_us, node);
+	latency_report("write -> read (total)", lc.recv, n);
+	latency_report("write -> kernel stamp (injection)", lc.sent, n);
+	latency_report("kernel stamp -> read (delivery)", lc.stamp, n);
+	if (lc.received < frames)
+		ret = RS_ERR;
+
+out:
+	if (lc.fd >= 0)
+		close(lc.fd);
+	free(lc.sent);
+	free(lc.stamp);
+	free(lc.recv);
+	return ret;
+}
+
+#ifdef WITH_BENCH
+/* ------------------ 基准测试 ------------------ */
+
+/*
+ * bench 只在 make bench 构建的 mca_uinput_bench 中提供，走真实的
+ * write_event()/syn() 路径，建议配合 --uinput 在虚拟设备上运行：
+ *
+ *   mca_uinput_bench --uinput bench [iterations]
+ *
+ * 结果以一行 JSON 输出到标准输出，便于不同板子和版本之间对比。
+ * 用 -d mem: 时只测轨迹生成和帧组装本身，不含系统调用。
+ */
+
+/** 延迟样本集合 */
+struct bench_samples {
+	long long *v;	/* 样本（纳秒） */
+	int n;			/* 已记录个数 */
+};
+
+/**
+ * @brief 输出一组样本的 p50/p99/max
+ * @param name JSON 字段名
+ * @param bs 样本集合（会被排序）
+ * @param div 输出单位换算除数（1 为纳秒，1000 为微秒）
+ * @param last 是否为最后一个字段
+ */
+static void bench_print(const char *name, struct bench_samples *bs, int div, int last) {
+	long long p50 = 0, p99 = 0, max = 0;
+
+	if (bs->n > 0) {
+		qsort(bs->v, bs->n, sizeof(bs->v[0]), latency_cmp);
+		p50 = bs->v[bs->n / 2];
+		p99 = bs->v[(int)((long long)bs->n * 99 / 100)];
+		max = bs->v[bs->n - 1];
+	}
+	printf("\"%s\":{\"p50\":%lld,\"p99\":%lld,\"max\":%lld}%s",
+		   name, p50 / div, p99 / div, max / div, last ? "" : ",");
+}
+
+/**
+ * @brief 换算吞吐量
+ * @param frames 帧数
+ * @param ns 耗时（纳秒）
+ * @return 每秒帧数
+ */
+static long long bench_rate(long long frames, long long ns) {
+	return ns > 0 ? frames * 1000000000LL / ns : 0;
+}
+
+/**
+ * @brief 运行注入基准测试
+ * @param td 触摸设备
+ * @param iters 每项测试的迭代次数
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int bench(struct touch_dev *td, int iters) {
+	struct bench_samples ev_lat, fr_lat, ms_err, dl_err;
+	struct path path = { PATH_LINEAR, 0, 0, 0 };
+	struct traj tr;
+	int holds = iters / 100 > 10 ? iters / 100 : 10;
+	int ret = RS_ERR;
+	long long t;
+
+	if (iters < 1)
+		iters = BENCH_ITERATIONS;
+	ev_lat.v = malloc(sizeof(long long) * iters);
+	fr_lat.v = malloc(sizeof(long long) * iters);
+	ms_err.v = malloc(sizeof(long long) * holds);
+	dl_err.v = malloc(sizeof(long long) * holds);
+	ev_lat.n = fr_lat.n = ms_err.n = dl_err.n = 0;
+	tr.ev = NULL;
+	tr.off = NULL;
+	if (!ev_lat.v || !fr_lat.v || !ms_err.v || !dl_err.v) {
+		fprintf(stderr, "out of memory\n");
+		goto out;
+	}
+
+	/* 单事件写入：每个事件一次 write()，相当于批处理之前的路径 */
+	for (int i = 0; i < iters; i++) {
+		t = mono_ns();
+		if (write_event(td, EV_ABS, ABS_X, i & 1) == RS_ERR || frame_flush(td) == RS_ERR)
+			goto out;
+		ev_lat.v[ev_lat.n++] = mono_ns() - t;
+	}
+
+	/* 整帧写入：ABS_X + ABS_Y + SYN_REPORT 一次提交 */
+	for (int i = 0; i < iters; i++) {
+		t = mono_ns();
+		if (write_event(td, EV_ABS, ABS_X, i & 1) == RS_ERR ||
+			write_event(td, EV_ABS, ABS_Y, i & 1) == RS_ERR ||
+			syn(td) == RS_ERR)
+			goto out;
+		fr_lat.v[fr_lat.n++] = mono_ns() - t;
+	}
+
+	/* tap：每次两帧（按下 + 抬起） */
+	long long tap_ns = mono_ns();
+	for (int i = 0; i < iters / 2; i++) {
+		if (do_tap(td, i % 100, i % 100, 0) == RS_ERR)
+			goto out;
+	}
+	tap_ns = mono_ns() - tap_ns;
+
+	/* swipe：预计算的轨迹帧逐帧写出 */
+	if (do_press(td, 0, 0) == RS_ERR ||
+		traj_build(td, &tr, &path, 0, 0, SCREEN_W - 1, SCREEN_H - 1, iters) == RS_ERR)
+		goto out;
+	long long swipe_ns = mono_ns();
+	for (int i = 0; i < tr.frames; i++) {
+		int n = tr.off[i + 1] - tr.off[i];
+		if (n > 0)
+			frames_stamp(td, tr.ev + tr.off[i], n);
+		if (n > 0 && write_frames(td, tr.ev + tr.off[i], n) == RS_ERR)
+			goto out;
+	}
+	swipe_ns = mono_ns() - swipe_ns;
+	if (do_release(td) == RS_ERR)
+		goto out;
+
+	/* 多指：所有手指每帧同时移动 */
+	struct slot_update u[SLOTS_LIMIT];
+	int fingers = td->nslots < BENCH_FINGERS ? td->nslots : BENCH_FINGERS;
+	for (int f = 0; f < fingers; f++) {
+		if (mt_down(td, f, f * 10, 0) == RS_ERR)
+			goto out;
+	}
+	long long mt_ns = mono_ns();
+	for (int i = 0; i < iters; i++) {
+		for (int f = 0; f < fingers; f++) {
+			u[f].slot = f;
+			u[f].x = f * 10 + (i & 7);
+			u[f].y = i & 7;
+		}
+		if (mt_frame(td, u, fingers) == RS_ERR)
+			goto out;
+	}
+	mt_ns = mono_ns() - mt_ns;
+	for (int f = 0; f < fingers; f++) {
+		if (mt_up(td, f) == RS_ERR)
+			goto out;
+	}
+
+	/* 保持时间误差：usleep 相对睡眠 vs 绝对截止时间 */
+	for (int i = 0; i < holds; i++) {
+		t = mono_ns();
+		msleep(BENCH_HOLD_MS);
+		ms_err.v[ms_err.n++] = mono_ns() - t - BENCH_HOLD_MS * 1000000LL;
+		t = mono_ns() + BENCH_HOLD_MS * 1000000LL;
+		sleep_until(t);
+		dl_err.v[dl_err.n++] = mono_ns() - t;
+	}
+
+	printf("{\"device\":\"%s\",\"iterations\":%d,\"fingers\":%d,",
+		   td->emit->name, iters, fingers);
+	bench_print("event_write_ns", &ev_lat, 1, 0);
+	bench_print("frame_write_ns", &fr_lat, 1, 0);
+	printf("\"tap_frames_per_s\":%lld,\"swipe_frames_per_s\":%lld,\"mt_frames_per_s\":%lld,",
+		   bench_rate(iters / 2 * 2, tap_ns), bench_rate(tr.frames, swipe_ns),
+		   bench_rate(iters, mt_ns));
+	printf("\"hold_ms\":%d,\"hold_error_us\":{", BENCH_HOLD_MS);
+	bench_print("msleep", &ms_err, 1000, 0);
+	bench_print("deadline", &dl_err, 1000, 1);
+	printf("}}\n");
+	ret = RS_OK;
+
+out:
+	traj_free(&tr);
+	free(ev_lat.v);
+	free(fr_lat.v);
+	free(ms_err.v);
+	free(dl_err.v);
+	return ret;
+}
+#endif
+
+/* ------------------ 实时调度 ------------------ */
+
+/*
+ * 与 UI、媒体进程同时运行时，普通调度下的唤醒经常晚几毫秒。--rt-prio
+ * 切换到 SCHED_FIFO，--cpu 绑定到一个 CPU，--mlock 锁定当前和以后分配的
+ * 内存以免缺页。三者在 main() 中打开设备之前设置一次，守护模式下一直
+ * 有效。通常需要 root 或 CAP_SYS_NICE/CAP_IPC_LOCK。
+ * 注意 SCHED_FIFO 下配合很大的 --spin 会长时间占住该 CPU。
+ */
+
+/**
+ * @brief 按 --rt-prio/--cpu/--mlock 设置调度和内存
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int rt_setup(void) {
+	if (cpu_opt >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu_opt, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+			fprintf(stderr, "sched_setaffinity cpu %d failed: %s\n", cpu_opt, strerror(errno));
+			return RS_ERR;
+		}
+	}
+	if (rt_prio > 0) {
+		struct sched_param sp;
+		memset(&sp, 0, sizeof(sp));
+		sp.sched_priority = rt_prio;
+		if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0) {
+			fprintf(stderr, "SCHED_FIFO priority %d failed: %s\n", rt_prio, strerror(errno));
+			return RS_ERR;
+		}
+	}
+	if (mlock_opt && mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		fprintf(stderr, "mlockall failed: %s\n", strerror(errno));
+		return RS_ERR;
+	}
+	return RS_OK;
+}
+
+/* ------------------ 命令解析 ------------------ */
+
+/*
+ * 文本命令（命令行、run 脚本、compile、serve 的文本连接）先由 cmd_parse()
+ * 解析为带标签的 struct cmd，再由 cmd_exec() 执行。数字参数用有长度上限的
+ * parse_int_len() 解析，格式错误、多余字符和越界都会报错，而不是像 atoi
+ * 那样静默得到 0 或截断的值。一条命令的全部段（& 分隔）都先解析完再执行，
+ * 任何一段有误时整条命令不产生输入事件。
+ *
+ * struct cmd 和 mt-frame 的更新表从会话（命令行、脚本、守护进程）自己的
+ * 固定大小 arena 分配，每执行完一行整体复位，命令流再长，解析也不触碰堆，
+ * 占用也不增长。
+ */
+
+/** 有界分配区 */
+struct arena {
+	size_t used;						/* 已分配字节数 */
+	unsigned char buf[ARENA_SIZE] __attribute__((aligned(16)));	/* 存储 */
+};
+
+/**
+ * @brief 从 arena 分配内存（16 字节对齐）
+ * @param a 分配区
+ * @param size 字节数
+ * @return 内存，空间不足时返回 NULL
+ */
+static void *arena_alloc(struct arena *a, size_t size) {
+	size = (size + 15) & ~(size_t)15;
+	if (size > ARENA_SIZE - a->used) {
+		fprintf(stderr, "command too large\n");
+		return NULL;
+	}
+	void *p = a->buf + a->used;
+	a->used += size;
+	return p;
+}
+
+/**
+ * @brief 复位 arena，之前分配的内存全部失效
+ * @param a 分配区
+ */
+static inline void arena_reset(struct arena *a) {
+	a->used = 0;
+}
+
+/**
+ * @brief 解析长度受限的十进制整数
+ * @param s 字符串（不需要以 '\0' 结尾）
+ * @param len 字符数
+ * @param lo 最小值
+ * @param hi 最大值
+ * @param out 输出
+ * @return RS_OK 成功，RS_ERR 为空、含非数字字符、超过 10 位或越界
+ */
+static int parse_int_len(const char *s, size_t len, int lo, int hi, int *out) {
+	const char *end = s + len;
+	long long v = 0;
+	int neg = 0;
+
+	if (s < end && (*s == '-' || *s == '+'))
+		neg = *s++ == '-';
+	if (s == end || end - s > 10)
+		return RS_ERR;
+	for (; s < end; s++) {
+		if (*s < '0' || *s > '9')
+			return RS_ERR;
+		v = v * 10 + (*s - '0');
+	}
+	if (neg)
+		v = -v;
+	if (v < lo || v > hi)
+		return RS_ERR;
+	*out = (int)v;
+	return RS_OK;
+}
+
+/**
+ * @brief 解析以 '\0' 结尾的十进制整数
+ * @see parse_int_len
+ */
+static inline int parse_int(const char *s, int lo, int hi, int *out) {
+	return parse_int_len(s, strlen(s), lo, hi, out);
+}
+
+/** 命令类型 */
+enum cmd_op {
+	CMD_TAP,		/* tap X Y [hold_ms] */
+	CMD_PRESS,		/* press X Y */
+	CMD_RELEASE,	/* release */
+	CMD_LONGPRESS,	/* longpress X Y hold_ms */
+	CMD_SWIPE,		/* swipe X1 Y1 X2 Y2 ms [steps] [path] */
+	CMD_MT_DOWN,	/* mt-down SLOT X Y */
+	CMD_MT_MOVE,	/* mt-move SLOT X Y */
+	CMD_MT_UP,		/* mt-up SLOT */
+	CMD_MT_FRAME,	/* mt-frame SLOT:X:Y ... */
+	CMD_PINCH,		/* pinch CX CY R1 R2 ms [steps] [fingers] */
+	CMD_ROTATE,		/* rotate CX CY R DEG ms [steps] [fingers] */
+	CMD_NSWIPE,		/* nswipe N X1 Y1 X2 Y2 ms [steps] [spacing] */
+	CMD_STRESS,		/* stress SECONDS [rate_hz] [fingers] [seed] */
+	CMD_CONTACT,	/* contact KEY=V[:V2] ... */
+	CMD_REPLAY,		/* replay FILE */
+	CMD_PLAY,		/* play FILE */
+	CMD_BENCH,		/* bench [iterations] */
+	CMD_SLEEP,		/* sleep MS */
+};
+
+/** 解析后的命令 */
+struct cmd {
+	enum cmd_op op;			/* 命令类型 */
+	const char *name;		/* 命令名（指向输入） */
+	union {
+		struct { int x, y, ms; } pt;				/* tap / press / longpress */
+		struct {
+			int x1, y1, x2, y2, ms, steps;
+			struct path path;
+		} swipe;									/* swipe */
+		struct { int slot, x, y; } mt;				/* mt-down / mt-move / mt-up */
+		struct { int n; struct slot_update *u; } frame;	/* mt-frame */
+		struct { struct mgesture g; int ms, steps; } gesture;	/* pinch / rotate / nswipe */
+		struct {
+			int seconds, rate, fingers;
+			unsigned long long seed;
+		} stress;									/* stress */
+		struct { int clear; struct contact c; } contact;	/* contact */
+		const char *path;							/* replay / play */
+		int n;										/* sleep 毫秒数，bench 迭代次数 */
+	} u;
+};
+
+/** 命令名与参数个数 */
+static const struct cmd_spec {
+	const char *name;	/* 命令名 */
+	enum cmd_op op;		/* 命令类型 */
+	int min;			/* 最少参数个数（不含命令名） */
+	int max;			/* 最多参数个数 */
+} cmd_specs[] = {
+	{ "tap", CMD_TAP, 2, 3 },
+	{ "press", CMD_PRESS, 2, 2 },
+	{ "release", CMD_RELEASE, 0, 0 },
+	{ "longpress", CMD_LONGPRESS, 3, 3 },
+	{ "swipe", CMD_SWIPE, 5, 7 },
+	{ "mt-down", CMD_MT_DOWN, 3, 3 },
+	{ "mt-move", CMD_MT_MOVE, 3, 3 },
+	{ "mt-up", CMD_MT_UP, 1, 1 },
+	{ "mt-frame", CMD_MT_FRAME, 1, MAX_ARGS },
+	{ "pinch", CMD_PINCH, 5, 7 },
+	{ "rotate", CMD_ROTATE, 5, 7 },
+	{ "nswipe", CMD_NSWIPE, 6, 8 },
+	{ "stress", CMD_STRESS, 1, 4 },
+	{ "contact", CMD_CONTACT, 1, MAX_ARGS },
+	{ "replay", CMD_REPLAY, 1, 1 },
+	{ "play", CMD_PLAY, 1, 1 },
+#ifdef WITH_BENCH
+	{ "bench", CMD_BENCH, 0, 1 },
+#endif
+	{ "sleep", CMD_SLEEP, 1, 1 },
+};
+
+/**
+ * @brief 检查命令参数数量
+ * @param argc 参数数量（含命令名）
+ * @param argv 参数列表
+ * @param n 至少需要的参数个数（不含命令名）
+ * @return 1 足够，0 不足
+ */
+static int need_args(int argc, char **argv, int n) {
+	if (argc > n)
+		return 1;
+	fprintf(stderr, "%s: missing operand\n", argv[0]);
+	return 0;
+}
+
+/**
+ * @brief 解析一个数字参数，出错时报告
+ * @param argv 参数列表（argv[0] 为命令名）
+ * @param i 参数序号
+ * @param lo 最小值
+ * @param hi 最大值
+ * @param out 输出
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int arg_int(char **argv, int i, int lo, int hi, int *out) {
+	if (parse_int(argv[i], lo, hi, out) == RS_OK)
+		return RS_OK;
+	fprintf(stderr, "%s: bad number '%s' (expected %d..%d)\n", argv[0], argv[i], lo, hi);
+	return RS_ERR;
+}
+
+/**
+ * @brief 解析可选的数字参数，缺省时取默认值
+ * @see arg_int
+ */
+static int arg_opt(int argc, char **argv, int i, int lo, int hi, int def, int *out) {
+	if (i >= argc) {
+		*out = def;
+		return RS_OK;
+	}
+	return arg_int(argv, i, lo, hi, out);
+}
+
+/**
+ * @brief 解析数字选项，出错时报告
+ * @param name 选项名（不含 --）
+ * @param s 选项值
+ * @param lo 最小值
+ * @param hi 最大值
+ * @param out 输出
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int opt_int(const char *name, const char *s, int lo, int hi, int *out) {
+	if (parse_int(s, lo, hi, out) == RS_OK)
+		return RS_OK;
+	fprintf(stderr, "--%s: bad number '%s' (expected %d..%d)\n", name, s, lo, hi);
+	return RS_ERR;
+}
+
+/**
+ * @brief 解析 contact 命令的参数
+ *
+ * 参数形如 KEY=START[:END]，KEY 为 p、major、minor、orient、tool；
+ * tool 另可写 finger、pen、palm，不能渐变。"off" 清除之前的全部参数，
+ * 包括同一命令中写在它前面的。
+ * @param argc 参数数量（argv[0] 为命令名）
+ * @param argv 参数列表
+ * @param clear 输出：是否出现了 off
+ * @param c 输出：最后一个 off 之后设置的参数
+ * @return RS_OK 成功，RS_ERR 参数错误
+ */
+static int contact_parse(int argc, char **argv, int *clear, struct contact *c) {
+	*clear = 0;
+	memset(c, 0, sizeof(*c));
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "off") == 0) {
+			*clear = 1;
+			memset(c, 0, sizeof(*c));
+			continue;
+		}
+		const char *eq = strchr(argv[i], '=');
+		int k;
+		for (k = 0; eq && k < CT_COUNT; k++) {
+			if (strlen(contact_keys[k]) == (size_t)(eq - argv[i]) &&
+				strncmp(argv[i], contact_keys[k], eq - argv[i]) == 0)
+				break;
+		}
+		if (!eq || k == CT_COUNT) {
+			fprintf(stderr, "contact: bad parameter '%s'\n", argv[i]);
+			return RS_ERR;
+		}
+		const char *v = eq + 1;
+		const char *colon = strchr(v, ':');
+		int lo = contact_range[k][0], hi = contact_range[k][1];
+		int ok;
+		if (k == CT_TOOL && strcmp(v, "finger") == 0) {
+			c->start[k] = MT_TOOL_FINGER;
+			ok = 1;
+		} else if (k == CT_TOOL && strcmp(v, "pen") == 0) {
+			c->start[k] = MT_TOOL_PEN;
+			ok = 1;
+		} else if (k == CT_TOOL && strcmp(v, "palm") == 0) {
+			c->start[k] = MT_TOOL_PALM;
+			ok = 1;
+		} else if (colon && k != CT_TOOL) {
+			ok = parse_int_len(v, colon - v, lo, hi, &c->start[k]) == RS_OK &&
+				parse_int(colon + 1, lo, hi, &c->end[k]) == RS_OK;
+		} else {
+			ok = parse_int(v, lo, hi, &c->start[k]) == RS_OK;
+		}
+		if (!ok) {
+			fprintf(stderr, "contact: bad value '%s' (expected %d..%d)\n", argv[i], lo, hi);
+			return RS_ERR;
+		}
+		if (!colon || k == CT_TOOL)
+			c->end[k] = c->start[k];
+		c->set |= 1 << k;
+	}
+	return RS_OK;
+}
+
+/**
+ * @brief 把一条命令解析为 struct cmd
+ * @param a 分配区
+ * @param argc 参数数量（argv[0] 为命令名）
+ * @param argv 参数列表（字符串在命令执行完之前必须有效）
+ * @return 命令，出错时返回 NULL
+ */
+static struct cmd *cmd_parse(struct arena *a, int argc, char **argv) {
+	const struct cmd_spec *sp = NULL;
+	int q = 0;		/* 角度等中间值 */
+
+	for (size_t i = 0; i < sizeof(cmd_specs) / sizeof(cmd_specs[0]); i++) {
+		if (strcmp(argv[0], cmd_specs[i].name) == 0) {
+			sp = &cmd_specs[i];
+			break;
+		}
+	}
+	if (!sp) {
+		fprintf(stderr, "unknown command '%s'\n", argv[0]);
+		return NULL;
+	}
+	if (!need_args(argc, argv, sp->min))
+		return NULL;
+	if (argc - 1 > sp->max) {
+		fprintf(stderr, "%s: too many operands\n", argv[0]);
+		return NULL;
+	}
+	struct cmd *c = arena_alloc(a, sizeof(*c));
+	if (!c)
+		return NULL;
+	memset(c, 0, sizeof(*c));
+	c->op = sp->op;
+	c->name = sp->name;
+
+	int ok = 1;
+	switch (c->op) {
+	case CMD_TAP:
+	case CMD_PRESS:
+	case CMD_LONGPRESS:
+		ok = arg_int(argv, 1, -COORD_LIMIT, COORD_LIMIT, &c->u.pt.x) == RS_OK &&
+			arg_int(argv, 2, -COORD_LIMIT, COORD_LIMIT, &c->u.pt.y) == RS_OK &&
+			arg_opt(argc, argv, 3, 0, DURATION_MAX_MS, 100, &c->u.pt.ms) == RS_OK;
+		break;
+	case CMD_RELEASE:
+		break;
+	case CMD_SWIPE:
+		ok = arg_int(argv, 1, -COORD_LIMIT, COORD_LIMIT, &c->u.swipe.x1) == RS_OK &&
+			arg_int(argv, 2, -COORD_LIMIT, COORD_LIMIT, &c->u.swipe.y1) == RS_OK &&
+			arg_int(argv, 3, -COORD_LIMIT, COORD_LIMIT, &c->u.swipe.x2) == RS_OK &&
+			arg_int(argv, 4, -COORD_LIMIT, COORD_LIMIT, &c->u.swipe.y2) == RS_OK &&
+			arg_int(argv, 5, 0, DURATION_MAX_MS, &c->u.swipe.ms) == RS_OK;
+		c->u.swipe.steps = 20;
+		c->u.swipe.path.type = PATH_LINEAR;
+		/* 可选参数：[steps] [path]，path 以字母开头 */
+		for (int i = 6; ok && i < argc; i++) {
+			if (isalpha((unsigned char)argv[i][0]))
+				ok = path_parse(argv[i], &c->u.swipe.path) == RS_OK;
+			else
+				ok = arg_int(argv, i, 0, TRAJ_MAX_FRAMES, &c->u.swipe.steps) == RS_OK;
+		}
+		break;
+	case CMD_MT_DOWN:
+	case CMD_MT_MOVE:
+	case CMD_MT_UP:
+		ok = arg_int(argv, 1, 0, SLOTS_LIMIT - 1, &c->u.mt.slot) == RS_OK;
+		if (ok && c->op != CMD_MT_UP)
+			ok = arg_int(argv, 2, -COORD_LIMIT, COORD_LIMIT, &c->u.mt.x) == RS_OK &&
+				arg_int(argv, 3, -COORD_LIMIT, COORD_LIMIT, &c->u.mt.y) == RS_OK;
+		break;
+	case CMD_MT_FRAME:
+		c->u.frame.n = argc - 1;
+		c->u.frame.u = arena_alloc(a, sizeof(*c->u.frame.u) * (argc - 1));
+		ok = c->u.frame.u != NULL;
+		for (int i = 1; ok && i < argc; i++) {
+			/* SLOT:X:Y */
+			struct slot_update *u = &c->u.frame.u[i - 1];
+			const char *s = argv[i];
+			const char *c1 = strchr(s, ':');
+			const char *c2 = c1 ? strchr(c1 + 1, ':') : NULL;
+			ok = c2 && parse_int_len(s, c1 - s, 0, SLOTS_LIMIT - 1, &u->slot) == RS_OK &&
+				parse_int_len(c1 + 1, c2 - c1 - 1, -COORD_LIMIT, COORD_LIMIT, &u->x) == RS_OK &&
+				parse_int(c2 + 1, -COORD_LIMIT, COORD_LIMIT, &u->y) == RS_OK;
+			if (!ok)
+				fprintf(stderr, "mt-frame: bad update '%s'\n", s);
+		}
+		break;
+	case CMD_PINCH:
+	case CMD_ROTATE: {
+		/* 双指（或多指）缩放 / 旋转 */
+		struct mgesture *g = &c->u.gesture.g;
+		int cx, cy, r1, r2;
+		g->type = MG_CIRCLE;
+		ok = arg_int(argv, 1, -COORD_LIMIT, COORD_LIMIT, &cx) == RS_OK &&
+			arg_int(argv, 2, -COORD_LIMIT, COORD_LIMIT, &cy) == RS_OK &&
+			arg_int(argv, 3, 0, COORD_LIMIT, &r1) == RS_OK &&
+			arg_int(argv, 4, -COORD_LIMIT, COORD_LIMIT, &q) == RS_OK &&
+			arg_int(argv, 5, 0, DURATION_MAX_MS, &c->u.gesture.ms) == RS_OK &&
+			arg_opt(argc, argv, 6, 0, TRAJ_MAX_FRAMES, 20, &c->u.gesture.steps) == RS_OK &&
+			arg_opt(argc, argv, 7, 1, SLOTS_LIMIT, 2, &g->fingers) == RS_OK;
+		r2 = c->op == CMD_PINCH ? q : r1;
+		if (ok && r2 < 0) {
+			fprintf(stderr, "%s: bad radius '%s'\n", argv[0], argv[4]);
+			ok = 0;
+		}
+		g->x1 = cx;
+		g->y1 = cy;
+		g->r1 = r1;
+		g->r2 = r2;
+		if (c->op == CMD_ROTATE)
+			g->a2 = q * M_PI / 180.0;
+		break;
+	}
+	case CMD_NSWIPE: {
+		/* 多指平行滑动 */
+		struct mgesture *g = &c->u.gesture.g;
+		int x1, y1, x2, y2, spacing;
+		g->type = MG_NSWIPE;
+		ok = arg_int(argv, 1, 1, SLOTS_LIMIT, &g->fingers) == RS_OK &&
+			arg_int(argv, 2, -COORD_LIMIT, COORD_LIMIT, &x1) == RS_OK &&
+			arg_int(argv, 3, -COORD_LIMIT, COORD_LIMIT, &y1) == RS_OK &&
+			arg_int(argv, 4, -COORD_LIMIT, COORD_LIMIT, &x2) == RS_OK &&
+			arg_int(argv, 5, -COORD_LIMIT, COORD_LIMIT, &y2) == RS_OK &&
+			arg_int(argv, 6, 0, DURATION_MAX_MS, &c->u.gesture.ms) == RS_OK &&
+			arg_opt(argc, argv, 7, 0, TRAJ_MAX_FRAMES, 20, &c->u.gesture.steps) == RS_OK &&
+			arg_opt(argc, argv, 8, -COORD_LIMIT, COORD_LIMIT, NSWIPE_SPACING, &spacing) == RS_OK;
+		g->x1 = x1;
+		g->y1 = y1;
+		g->x2 = x2;
+		g->y2 = y2;
+		g->spacing = spacing;
+		break;
+	}
+	case CMD_STRESS:
+		ok = arg_int(argv, 1, 0, INT_MAX, &c->u.stress.seconds) == RS_OK &&
+			arg_opt(argc, argv, 2, 1, RATE_MAX_HZ, STRESS_RATE_HZ, &c->u.stress.rate) == RS_OK &&
+			arg_opt(argc, argv, 3, 1, SLOTS_LIMIT, STRESS_FINGERS, &c->u.stress.fingers) == RS_OK;
+		if (ok && argc > 4) {
+			/* 种子是 64 位，单独解析 */
+			char *end;
+			errno = 0;
+			c->u.stress.seed = strtoull(argv[4], &end, 0);
+			if (end == argv[4] || *end != '\0' || errno) {
+				fprintf(stderr, "stress: bad seed '%s'\n", argv[4]);
+				ok = 0;
+			}
+		}
+		break;
+	case CMD_CONTACT:
+		ok = contact_parse(argc, argv, &c->u.contact.clear, &c->u.contact.c) == RS_OK;
+		break;
+	case CMD_REPLAY:
+	case CMD_PLAY:
+		c->u.path = argv[1];
+		break;
+	case CMD_BENCH:
+		ok = arg_opt(argc, argv, 1, 1, INT_MAX, BENCH_ITERATIONS, &c->u.n) == RS_OK;
+		break;
+	case CMD_SLEEP:
+		ok = arg_int(argv, 1, 0, DURATION_MAX_MS, &c->u.n) == RS_OK;
+		break;
+	}
+	return ok ? c : NULL;
+}
+
+/* ------------------ 命令分发 ------------------ */
+
+/**
+ * @brief 执行一条解析好的命令
+ * @param td 触摸设备
+ * @param c 命令
+ * @return RS_OK 成功，RS_ERR 失败
+ */
+static int cmd_exec(struct touch_dev *td, const struct cmd *c) {
+	switch (c->op) {
+	case CMD_TAP:
+		return do_tap(td, c->u.pt.x, c->u.pt.y, c->u.pt.ms);
+	case CMD_PRESS:
+		return do_press(td, c->u.pt.x, c->u.pt.y);
+	case CMD_RELEASE:
+		return do_release(td);
+	case CMD_LONGPRESS:
+		return do_longpress(td, c->u.pt.x, c->u.pt.y, c->u.pt.ms);
+	case CMD_SWIPE:
+		return do_swipe(td, c->u.swipe.x1, c->u.swipe.y1, c->u.swipe.x2, c->u.swipe.y2,
+						c->u.swipe.ms, c->u.swipe.steps, &c->u.swipe.path);
+	case CMD_MT_DOWN:
+		return mt_down(td, c->u.mt.slot, c->u.mt.x, c->u.mt.y);
+	case CMD_MT_MOVE:
+		return mt_move(td, c->u.mt.slot, c->u.mt.x, c->u.mt.y);
+	case CMD_MT_UP:
+		return mt_up(td, c->u.mt.slot);
+	case CMD_MT_FRAME:
+		return mt_frame(td, c->u.frame.u, c->u.frame.n);
+	case CMD_PINCH:
+	case CMD_ROTATE:
+	case CMD_NSWIPE:
+		return mt_gesture(td, &c->u.gesture.g, c->u.gesture.ms, c->u.gesture.steps, c->name);
+	case CMD_STRESS:
+		return stress(td, c->u.stress.seconds, c->u.stress.rate, c->u.stress.fingers,
+					  c->u.stress.seed);
+	case CMD_CONTACT:
+		return contact_set(td, c->u.contact.clear, &c->u.contact.c);
+	case CMD_REPLAY:
+		return replay(td, c->u.path);
+	case CMD_PLAY:
+		return play(td, c->u.path);
+	case CMD_BENCH:
+#ifdef WITH_BENCH
+		return bench(td, c->u.n);
+#else
+		return RS_ERR;
+#endif
+	case CMD_SLEEP:
+		/* 命令间延迟 */
+		msleep(c->u.n);
+		return RS_OK;
+	}
+	return RS_ERR;
+}
+
+/* ------------------ 多设备 ------------------ */
+
+/*
+ * -d 可以重复给出，每个设备有自己的轴缓存、--map 映射、slot 状态和帧缓冲。
+ * 命令前缀 @NAME 指定目标设备（@all 表示全部设备），没有前缀时发往第一个
+ * 设备。一条命令中用单独的 & 分隔多段时，各段在各自的线程中同时执行：
+ * 所有线程等到同一个单调时钟起点（PAR_LEAD_US 之后）再开始，各自的手势
+ * 截止时间都从这一起点算起，跨屏拖动因此保持时间对齐。
+ *
+ *   @left swipe 1800 200 1919 200 300 & @right swipe 0 200 120 200 300
+ */
+
+static struct touch_dev *dev_table = NULL;	/* 已打开的设备 */
+static int dev_count = 0;					/* 设备数 */
+
+/** 并行执行的一段命令 */
+struct par_job {
+	struct touch_dev *td;	/* 目标设备 */
+	const struct cmd *cmd;	/* 该段的命令 */
+	long long start;		/* 公共起点（单调时钟，纳秒） */
+	int ret;				/* 执行结果 */
+	struct stats stats;		/* 该线程的计数器 */
+};
+
+/**
+ * @brief 按名称查找设备
+ * @param name 设备名称
+ * @return 设备，找不到返回 NULL
  */
-static void msleep(int ms) {
-	if(ms > 0) usleep(ms*1000);
+static struct touch_dev *dev_find(const char *name) {
+	for (int i = 0; i < dev_count; i++) {
+		if (strcmp(dev_table[i].name, name) == 0)
+			return &dev_table[i];
+	}
+	fprintf(stderr, "unknown device: @%s\n", name);
+	return NULL;
 }
 
 /**
- * @brief 读取绝对轴信息
- * @param fd 设备文件描述符
- * @param code 轴代码
- * @param ainfo 存储读取结果的结构体指针
- * @return RS_OK 成功，RS_ERR 失败
+ * @brief 并行命令的线程入口
  */
-static int read_absinfo(int fd, unsigned int code, struct input_absinfo *ainfo) {
-    return ioctl(fd, EVIOCGABS(code), ainfo) < 0 ? RS_ERR : RS_OK;
+static void *par_thread(void *arg) {
+	struct par_job *job = arg;
+
+	span_tid = (int)(job->td - dev_table) + 1;
+	report_alloc();
+	sleep_until(job->start);
+	job->ret = cmd_exec(job->td, job->cmd);
+	job->stats = stats;
+	free(report_buf);
+	return NULL;
 }
 
 /**
- * @brief 映射 UI 坐标到设备坐标（X 轴）
- * @param fd 设备文件描述符
- * @param lx UI 屏幕 X 坐标
- * @return 设备坐标 X
+ * @brief 按 @NAME 前缀和 & 分隔执行命令
+ * @param td 默认设备
+ * @param a 解析用的分配区
+ * @param argc 参数个数
+ * @param argv 参数
+ * @return RS_OK 全部成功，RS_ERR 有失败
  */
-static int map_x(int fd, int lx) {
-    if (!ui_w) return lx;
-    struct input_absinfo ax;
-    if (read_absinfo(fd, ABS_MT_POSITION_X, &ax) < 0 &&
-		read_absinfo(fd, ABS_X, &ax) < 0) {
-		return lx;
+static int route_cmd(struct touch_dev *td, struct arena *a, int argc, char **argv) {
+	struct par_job jobs[DEVICES_MAX];
+	pthread_t tid[DEVICES_MAX];
+	int njobs = 0;
+	int ret = RS_OK;
+
+	for (int i = 0; i < argc; ) {
+		int j = i;
+		while (j < argc && strcmp(argv[j], "&") != 0)
+			j++;
+		if (j == i) {
+			fprintf(stderr, "empty command before '&'\n");
+			return RS_ERR;
+		}
+
+		/* @all 展开为每个设备一段，其余 @NAME 只取一个设备 */
+		struct touch_dev *first = td, *last = td;
+		int skip = 0;
+		if (argv[i][0] == '@') {
+			skip = 1;
+			if (strcmp(argv[i] + 1, "all") == 0) {
+				first = &dev_table[0];
+				last = &dev_table[dev_count - 1];
+			}
+			else if ((first = last = dev_find(argv[i] + 1)) == NULL)
+				return RS_ERR;
+		}
+		if (j - i - skip < 1) {
+			fprintf(stderr, "%s: missing command\n", argv[i]);
+			return RS_ERR;
+		}
+		/* 同一段发往多个设备时共用一份解析结果 */
+		const struct cmd *c = cmd_parse(a, j - i - skip, argv + i + skip);
+		if (!c)
+			return RS_ERR;
+		for (struct touch_dev *d = first; d <= last; d++) {
+			for (int k = 0; k < njobs; k++) {
+				if (jobs[k].td == d) {
+					fprintf(stderr, "device %s used twice in one command\n", d->name);
+					return RS_ERR;
+				}
+			}
+			/* 每个设备最多一段，段数不会超过 DEVICES_MAX */
+			jobs[njobs].td = d;
+			jobs[njobs].cmd = c;
+			njobs++;
+		}
+		i = j + 1;
+	}
+
+	if (njobs == 0)
+		return RS_OK;
+	/* compile 只捕获一个设备，虚拟时钟也不能被多个线程推进 */
+	if (virt_ns >= 0 && (njobs > 1 || jobs[0].td->emit != &emit_capture)) {
+		fprintf(stderr, "compile supports only the first device and no '&'\n");
+		return RS_ERR;
+	}
+	if (njobs == 1)
+		return cmd_exec(jobs[0].td, jobs[0].cmd);
+
+	long long start = mono_ns() + PAR_LEAD_US * 1000LL;
+	int started = 0;
+	for (; started < njobs; started++) {
+		jobs[started].start = start;
+		jobs[started].ret = RS_ERR;
+		memset(&jobs[started].stats, 0, sizeof(jobs[started].stats));
+		if (pthread_create(&tid[started], NULL, par_thread, &jobs[started]) != 0) {
+			fprintf(stderr, "pthread_create failed\n");
+			ret = RS_ERR;
+			break;
+		}
+	}
+	for (int k = 0; k < started; k++) {
+		pthread_join(tid[k], NULL);
+		stats_merge(&jobs[k].stats);
+		if (jobs[k].ret == RS_ERR)
+			ret = RS_ERR;
 	}
-    long long min = ax.minimum, max = ax.maximum;
-    return (lx*(max-min)/ui_w + min);
+	return ret;
 }
 
 /**
- * @brief 映射 UI 坐标到设备坐标（Y 轴）
- * @param fd 设备文件描述符
- * @param ly UI 屏幕 Y 坐标
- * @return 设备坐标 Y
+ * @brief 把一行文本就地切分为参数列表
+ * @param line 待切分的行（会被修改）
+ * @param argv 输出的参数列表
+ * @param max argv 容量
+ * @return 参数个数，空行或注释行返回 0，参数过多返回 RS_ERR
  */
-static int map_y(int fd, int ly) {
-    if (!ui_h) return ly;
-    struct input_absinfo ay;
-    if (read_absinfo(fd, ABS_MT_POSITION_Y, &ay) < 0 && read_absinfo(fd, ABS_Y, &ay) < 0) {
-		return ly;
+static int split_line(char *line, char **argv, int max) {
+	int argc = 0;
+	char *p = line;
+
+	for (;;) {
+		while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+			*p++ = '\0';
+		if (*p == '\0' || *p == '#')
+			break;
+		if (argc == max)
+			return RS_ERR;
+		argv[argc++] = p;
+		while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+			p++;
 	}
-    long long min = ay.minimum, max = ay.maximum;
-    return (ly*(max-min)/ui_h + min);
+	return argc;
 }
 
 /**
- * @brief 设置 BTN_TOUCH 状态
- * @param fd 设备文件描述符
- * @param val 状态值（1 按下，0 抬起）
- * @return RS_OK 成功，RS_ERR 失败
+ * @brief 执行一行文本命令
+ * @param td 触摸设备
+ * @param a 解析用的分配区，本行执行完后复位
+ * @param line 命令行（会被修改）
+ * @return RS_OK 成功（空行视为成功），RS_ERR 失败
  */
-static int btn_touch_set(int fd, int val) {
-    if (write_event(fd, EV_KEY, BTN_TOUCH, val) == RS_ERR) {
+static int run_line(struct touch_dev *td, struct arena *a, char *line) {
+	char *argv[MAX_ARGS];
+	int argc = split_line(line, argv, MAX_ARGS);
+
+	if (argc == RS_ERR) {
+		fprintf(stderr, "too many arguments\n");
 		return RS_ERR;
 	}
-    return syn(fd);
+	int ret = argc > 0 ? route_cmd(td, a, argc, argv) : RS_OK;
+	arena_reset(a);
+	return ret;
 }
 
-/* ------------------ 单点操作 ------------------ */
+/* ------------------ 脚本模式 ------------------ */
 
 /**
- * @brief 单点点击
- * @param fd 设备文件描述符
- * @param lx UI 屏幕 X 坐标
- * @param ly UI 屏幕 Y 坐标
- * @param hold_ms 按下保持时间（毫秒）
- * @return RS_OK 成功，RS_ERR 失败
+ * @brief 逐行读取并执行命令脚本
+ *
+ * 每次只读一行到固定缓冲，脚本大小不受内存限制。遇到第一条失败的命令即停止。
+ *
+ * @param td 触摸设备
+ * @param path 脚本路径，"-" 表示标准输入
+ * @return RS_OK 全部成功，RS_ERR 失败
  */
-static int do_tap(int fd, int lx, int ly, int hold_ms) {
-    int x = map_x(fd, lx);
-	int y = map_y(fd, ly);
-	if (write_event(fd, EV_KEY, BTN_TOUCH, 1) == RS_ERR ||
-		write_event(fd, EV_KEY, BTN_TOOL_FINGER, 1) == RS_ERR ||
-		write_event(fd, EV_ABS, ABS_MT_POSITION_X, x) == RS_ERR ||
-		write_event(fd, EV_ABS, ABS_MT_POSITION_Y, y) == RS_ERR ||
-		syn_mt(fd) == RS_ERR ||
-		syn(fd) == RS_ERR) {
+static int run_script(struct touch_dev *td, const char *path) {
+	static struct arena arena;
+	char line[LINE_MAX_LEN];
+	FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	int lineno = 0;
+	int ret = RS_OK;
+
+	if (!fp) {
+		fprintf(stderr, "open %s failed: %s\n", path, strerror(errno));
 		return RS_ERR;
 	}
 
-    msleep(hold_ms);
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (!strchr(line, '\n') && !feof(fp)) {
+			fprintf(stderr, "%s:%d: line too long\n", path, lineno);
+			ret = RS_ERR;
+			break;
+		}
+		if (run_line(td, &arena, line) == RS_ERR) {
+			fprintf(stderr, "%s:%d: command failed\n", path, lineno);
+			ret = RS_ERR;
+			break;
+		}
+	}
+	if (ret == RS_OK && ferror(fp)) {
+		fprintf(stderr, "read %s failed: %s\n", path, strerror(errno));
+		ret = RS_ERR;
+	}
 
-    if (write_event(fd, EV_KEY, BTN_TOUCH, 0) == RS_ERR ||
-		write_event(fd, EV_KEY, BTN_TOOL_FINGER, 0) == RS_ERR ||
-		syn_mt(fd) == RS_ERR ||
-        syn(fd) == RS_ERR) {
-        return RS_ERR;
-    }
-    return RS_OK;
+	if (fp != stdin)
+		fclose(fp);
+	return ret;
 }
 
 /**
- * @brief 按下操作（不抬起）
- * @param fd 设备文件描述符
- * @param lx UI 屏幕 X 坐标
- * @param ly UI 屏幕 Y 坐标
+ * @brief 把脚本编译为可直接写入设备的事件文件
+ * @param td 触摸设备（提供轴信息和映射，编译期间不写入）
+ * @param script 脚本路径，"-" 表示标准输入
+ * @param out 输出文件路径
  * @return RS_OK 成功，RS_ERR 失败
  */
-static int do_press(int fd, int lx, int ly) {
-    int x = map_x(fd, lx);
-	int y = map_y(fd, ly);
-	if (write_event(fd, EV_KEY, BTN_TOUCH, 1) == RS_ERR ||
-		write_event(fd, EV_KEY, BTN_TOOL_FINGER, 1) == RS_ERR ||
-		write_event(fd, EV_ABS, ABS_MT_POSITION_X, x) == RS_ERR ||
-		write_event(fd, EV_ABS, ABS_MT_POSITION_Y, y) == RS_ERR ||
-		syn_mt(fd) == RS_ERR ||
-		syn(fd) == RS_ERR) {
+static int compile(struct touch_dev *td, const char *script, const char *out) {
+	struct compiled_header hdr;
+	struct capture cap;
+	int ret;
+
+	/* 虚拟时钟从 0 开始，时间戳交给内核赋值 */
+	const struct emitter *emit = td->emit;
+	void *ctx = td->emit_ctx;
+	int saved_clock = clock_opt;
+	memset(&cap, 0, sizeof(cap));
+	td->emit = &emit_capture;
+	td->emit_ctx = &cap;
+	virt_ns = 0;
+	clock_opt = -1;
+	ret = run_script(td, script);
+	virt_ns = -1;
+	clock_opt = saved_clock;
+	td->emit = emit;
+	td->emit_ctx = ctx;
+
+	if (ret == RS_OK) {
+		long page = sysconf(_SC_PAGESIZE);
+		size_t table = sizeof(hdr) + sizeof(*cap.frames) * cap.nframes;
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, COMPILED_MAGIC, 4);
+		hdr.version = COMPILED_VERSION;
+		hdr.naxes = AXIS_COUNT;
+		hdr.nframes = cap.nframes;
+		hdr.nevents = cap.nev;
+		hdr.ev_offset = (uint32_t)((table + page - 1) / page * page);
+		hdr.ev_size = sizeof(struct input_event);
+		for (int i = 0; i < AXIS_COUNT; i++) {
+			hdr.axes[i][0] = td->axes[i].valid;
+			hdr.axes[i][1] = td->axes[i].min;
+			hdr.axes[i][2] = td->axes[i].max;
+			hdr.axes[i][3] = td->axes[i].res;
+		}
+
+		FILE *fp = fopen(out, "wb");
+		if (!fp) {
+			fprintf(stderr, "open %s failed: %s\n", out, strerror(errno));
+			ret = RS_ERR;
+		}
+		else {
+			static const char zero[64];
+			size_t pad = hdr.ev_offset - table;
+			fwrite(&hdr, sizeof(hdr), 1, fp);
+			fwrite(cap.frames, sizeof(*cap.frames), cap.nframes, fp);
+			while (pad > 0) {
+				size_t k = pad < sizeof(zero) ? pad : sizeof(zero);
+				fwrite(zero, 1, k, fp);
+				pad -= k;
+			}
+			fwrite(cap.ev, sizeof(*cap.ev), cap.nev, fp);
+			if (ferror(fp) | (fclose(fp) != 0)) {
+				fprintf(stderr, "write %s failed\n", out);
+				ret = RS_ERR;
+			}
+			else {
+				fprintf(stderr, "compiled %d events in %d batches, %lld ms\n",
+						cap.nev, cap.nframes,
+						cap.nframes ? (long long)cap.frames[cap.nframes - 1].offset_ns / 1000000 : 0);
+			}
+		}
+	}
+
+	free(cap.frames);
+	free(cap.ev);
+	return ret;
+}
+
+/* ------------------ 守护模式 ------------------ */
+
+/*
+ * serve 模式只打开一次设备（并保持 --grab），在 Unix 域套接字上按行接收命令，
+ * 命令词汇与命令行相同，每行回复 "OK" 或 "ERR"。多点 slot/tracking 状态
+ * 在进程内保持，跨命令不会丢失。命令串行执行，手势执行期间不处理其他客户端。
+ *
+ *   echo "tap 400 240" | socat - UNIX-CONNECT:/tmp/mca_uinput.sock
+ *
+ * 监听地址可以给多个：普通路径为上述文本协议，tcp:[HOST:]PORT 和
+ * udp:[HOST:]PORT 使用 uinput_proto.h 中的二进制协议。
+ */
+
+/** 监听地址类型 */
+enum serve_kind {
+	SERVE_UNIX,		/* Unix 域套接字，文本协议 */
+	SERVE_TCP,		/* TCP，二进制协议，批量确认 */
+	SERVE_UDP,		/* UDP，二进制协议，不确认 */
+};
+
+/** 一个监听地址 */
+struct serve_listener {
+	int fd;					/* 监听（UDP 为收包）描述符 */
+	enum serve_kind kind;	/* 类型 */
+	const char *path;		/* Unix 域套接字路径，退出时删除 */
+};
+
+/** 一个客户端连接 */
+struct serve_client {
+	int fd;						/* 连接描述符，-1 表示空闲 */
+	enum serve_kind kind;		/* 所属监听地址的类型 */
+	int len;					/* 行缓冲已用长度 */
+	char buf[LINE_MAX_LEN];		/* 行缓冲（二进制协议时为请求缓冲） */
+};
+
+/** 共享内存命令环（--shm） */
+struct serve_shm {
+	struct mca_shm_ring *ring;	/* 映射的命令环，NULL 表示未启用 */
+	size_t size;				/* 映射长度 */
+	int efd;					/* 唤醒用 eventfd */
+	int corrupt;				/* 已报告过越界的 head */
+};
+
+/** 二进制协议中待合并为一帧的 MCA_OP_MT_MOVE */
+struct proto_batch {
+	struct touch_dev *td;					/* 目标设备，NULL 表示为空 */
+	struct slot_update u[SLOTS_LIMIT];		/* 各手指的新位置 */
+	int n;									/* 个数 */
+};
+
+/**
+ * @brief 创建监听用的 Unix 域套接字
+ * @param path 套接字路径（已存在时先删除）
+ * @return 成功返回监听描述符，失败返回 RS_ERR
+ */
+static int serve_listen(const char *path) {
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "serve: socket path too long\n");
 		return RS_ERR;
 	}
-	return RS_OK;
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "socket failed: %s\n", strerror(errno));
+		return RS_ERR;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(fd, SERVE_CLIENTS) < 0) {
+		fprintf(stderr, "bind %s failed: %s\n", path, strerror(errno));
+		close(fd);
+		return RS_ERR;
+	}
+	return fd;
 }
 
 /**
- * @brief 抬起操作
- * @param fd 设备文件描述符
- * @return RS_OK 成功，RS_ERR 失败
+ * @brief 创建 TCP 监听或 UDP 收包套接字
+ * @param spec [HOST:]PORT，省略 HOST 时监听全部地址
+ * @param type SOCK_STREAM 或 SOCK_DGRAM
+ * @return 成功返回描述符，失败返回 RS_ERR
  */
-static int do_release(int fd) {
-    if (write_event(fd, EV_KEY, BTN_TOUCH, 0) == RS_ERR ||
-		write_event(fd, EV_KEY, BTN_TOOL_FINGER, 0) == RS_ERR ||
-		syn_mt(fd) == RS_ERR ||
-        syn(fd) == RS_ERR) {
-        return RS_ERR;
-    }
-    return RS_OK;
+static int serve_listen_inet(const char *spec, int type) {
+	struct sockaddr_in addr;
+	const char *colon = strrchr(spec, ':');
+	char host[64];
+	int one = 1;
+	int port;
+	int fd;
+
+	if (parse_int(colon ? colon + 1 : spec, 1, 65535, &port) == RS_ERR) {
+		fprintf(stderr, "serve: bad port in %s\n", spec);
+		return RS_ERR;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons((uint16_t)port);
+	if (colon) {
+		snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+		if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+			fprintf(stderr, "serve: bad address %s\n", spec);
+			return RS_ERR;
+		}
+	}
+	fd = socket(AF_INET, type, 0);
+	if (fd < 0) {
+		fprintf(stderr, "socket failed: %s\n", strerror(errno));
+		return RS_ERR;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		(type == SOCK_STREAM && listen(fd, SERVE_CLIENTS) < 0)) {
+		fprintf(stderr, "bind %s failed: %s\n", spec, strerror(errno));
+		close(fd);
+		return RS_ERR;
+	}
+	return fd;
 }
 
 /**
- * @brief 长按
- * @param fd 设备文件描述符
- * @param lx UI 屏幕 X 坐标
- * @param ly UI 屏幕 Y 坐标
- * @param hold_ms 按下保持时间（毫秒）
+ * @brief 提交合并中的 MT_MOVE 帧
+ * @param b 合并状态
  * @return RS_OK 成功，RS_ERR 失败
  */
-static int do_longpress(int fd, int lx, int ly, int hold_ms) {
-    return do_tap(fd, lx, ly, hold_ms);
+static int proto_flush(struct proto_batch *b) {
+	int ret = RS_OK;
+
+	if (b->td && b->n > 0)
+		ret = mt_frame(b->td, b->u, b->n);
+	b->td = NULL;
+	b->n = 0;
+	return ret;
 }
 
 /**
- * @brief 滑动操作
- * @param fd 设备文件描述符
- * @param x1 起点 X 坐标
- * @param y1 起点 Y 坐标
- * @param x2 终点 X 坐标
- * @param y2 终点 Y 坐标
- * @param duration_ms 滑动总时长（毫秒）
- * @param steps 滑动步数
+ * @brief 执行一个二进制请求
+ * @param r 请求（小端序，原样来自网络）
+ * @param b MT_MOVE 合并状态
  * @return RS_OK 成功，RS_ERR 失败
  */
-static int do_swipe(int fd,int x1,int y1,int x2,int y2,int duration_ms,int steps) {
-    if(steps < 1) {
-		steps = 10;
+static int proto_exec(const struct mca_req *r, struct proto_batch *b) {
+	int x = (int16_t)le16toh((uint16_t)r->x), y = (int16_t)le16toh((uint16_t)r->y);
+	int x2 = (int16_t)le16toh((uint16_t)r->x2), y2 = (int16_t)le16toh((uint16_t)r->y2);
+	uint32_t ms = le32toh(r->ms);
+	struct path linear = { PATH_LINEAR, 0, 0, 0 };
+	int ret = RS_OK;
+
+	if (r->dev >= dev_count) {
+		fprintf(stderr, "proto: no device %d\n", r->dev);
+		proto_flush(b);
+		return RS_ERR;
 	}
+	struct touch_dev *td = &dev_table[r->dev];
 
-    if(do_tap(fd, x1, y1, 0) == RS_ERR) {
+	/* 与文本命令相同的范围检查，越界的请求不执行，计入 ack 的失败数 */
+	int mt = r->op == MCA_OP_MT_DOWN || r->op == MCA_OP_MT_MOVE || r->op == MCA_OP_MT_UP;
+	if (ms > DURATION_MAX_MS || (mt && r->slot >= td->nslots)) {
+		fprintf(stderr, "proto: request %u out of range\n", le16toh(r->seq));
+		proto_flush(b);
 		return RS_ERR;
 	}
 
-    for(int i = 1; i <= steps; i++){
-        float t = (float)i / steps;
-        int xi = x1 + (x2 - x1) * t;
-        int yi = y1 + (y2 - y1) * t;
-		if (write_event(fd, EV_ABS, ABS_X, map_x(fd, xi)) == RS_ERR ||
-			write_event(fd, EV_ABS, ABS_Y, map_y(fd, yi)) == RS_ERR ||
-			syn(fd) == RS_ERR) {
-			return RS_ERR;
-		}
-        msleep(duration_ms / steps);
-    }
+	if (r->op == MCA_OP_MT_MOVE) {
+		/* 同一设备上连续的移动合并为一帧，slot 重复时先提交已有部分 */
+		int dup = b->td != td;
+		for (int i = 0; i < b->n && !dup; i++)
+			dup = b->u[i].slot == r->slot;
+		if ((dup || b->n == SLOTS_LIMIT) && proto_flush(b) == RS_ERR)
+			ret = RS_ERR;
+		b->td = td;
+		b->u[b->n].slot = r->slot;
+		b->u[b->n].x = x;
+		b->u[b->n].y = y;
+		b->n++;
+		return ret;
+	}
 
-	if (write_event(fd, EV_KEY, BTN_TOUCH, 0) == RS_ERR ||
-		syn(fd) == RS_ERR) {
+	if (proto_flush(b) == RS_ERR)
+		ret = RS_ERR;
+	switch (r->op) {
+	case MCA_OP_TAP:
+		return do_tap(td, x, y, ms) == RS_ERR ? RS_ERR : ret;
+	case MCA_OP_PRESS:
+		return do_press(td, x, y) == RS_ERR ? RS_ERR : ret;
+	case MCA_OP_RELEASE:
+		return do_release(td) == RS_ERR ? RS_ERR : ret;
+	case MCA_OP_SWIPE:
+		return do_swipe(td, x, y, x2, y2, ms, r->steps ? r->steps : 20, &linear) == RS_ERR ?
+			RS_ERR : ret;
+	case MCA_OP_MT_DOWN:
+		return mt_down(td, r->slot, x, y) == RS_ERR ? RS_ERR : ret;
+	case MCA_OP_MT_UP:
+		return mt_up(td, r->slot) == RS_ERR ? RS_ERR : ret;
+	case MCA_OP_SLEEP:
+		msleep(ms);
+		return ret;
+	default:
+		fprintf(stderr, "proto: unknown opcode %d\n", r->op);
 		return RS_ERR;
 	}
+}
 
-    return RS_OK;
+/**
+ * @brief 执行缓冲中的全部完整请求
+ * @param buf 请求缓冲
+ * @param len 缓冲长度
+ * @param ack 输出：最后一个请求的 seq 和失败数
+ * @return 已处理的字节数
+ */
+static int proto_run(const char *buf, int len, struct mca_ack *ack) {
+	struct proto_batch b;
+	struct mca_req r;
+	int off = 0;
+	int errors = 0;
+
+	b.td = NULL;
+	b.n = 0;
+	ack->seq = 0;
+	for (; off + (int)sizeof(r) <= len; off += sizeof(r)) {
+		memcpy(&r, buf + off, sizeof(r));
+		if (proto_exec(&r, &b) == RS_ERR)
+			errors++;
+		ack->seq = r.seq;
+	}
+	if (proto_flush(&b) == RS_ERR)
+		errors++;
+	ack->errors = htole16((uint16_t)errors);
+	return off;
 }
 
-#if MAX_SLOTS > 1
-/* ------------------ 多点 MT 操作 ------------------ */
+/**
+ * @brief 处理二进制协议客户端的可读事件，每批回复一个 ack
+ * @param c 客户端
+ * @return RS_OK 连接保持，RS_ERR 连接应关闭
+ */
+static int serve_proto_read(struct serve_client *c) {
+	struct mca_ack ack;
+	ssize_t n = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN))
+		return RS_OK;
+	if (n <= 0)
+		return RS_ERR;
+	c->len += n;
+	if (c->len < (int)sizeof(struct mca_req))
+		return RS_OK;
+
+	int used = proto_run(c->buf, c->len, &ack);
+	c->len -= used;
+	memmove(c->buf, c->buf + used, c->len);
+	return write(c->fd, &ack, sizeof(ack)) == sizeof(ack) ? RS_OK : RS_ERR;
+}
 
 /**
- * @brief 多点触控按下
- * @param fd 设备文件描述符
- * @param slot 触控点 slot 编号
- * @param lx UI 屏幕 X 坐标
- * @param ly UI 屏幕 Y 坐标
+ * @brief 创建共享内存命令环和 eventfd
+ * @param sh 命令环状态
+ * @param name shm_open() 名称（如 /mca_uinput）
  * @return RS_OK 成功，RS_ERR 失败
  */
-static int mt_down(int fd, int slot, int lx, int ly) {
-    if (slot < 0 || slot >= MAX_SLOTS) 
+static int shm_open_ring(struct serve_shm *sh, const char *name) {
+	sh->size = sizeof(struct mca_shm_ring) + sizeof(struct mca_req) * SHM_RING_RECORDS;
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0 || ftruncate(fd, sh->size) < 0) {
+		fprintf(stderr, "shm_open %s failed: %s\n", name, strerror(errno));
+		if (fd >= 0)
+			close(fd);
 		return RS_ERR;
-
-    int x = map_x(fd, lx);
-	int y = map_y(fd, ly);
-    int tid = next_tracking_id++;
-    if (next_tracking_id > 1000000) {
-		next_tracking_id = 1;
 	}
-
-    slot_tracking[slot] = tid;
-	if (active_touches == 0) {
-		if (btn_touch_set(fd, 1) == RS_ERR) {
-			return RS_ERR;
-		}
+	sh->ring = mmap(NULL, sh->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (sh->ring == MAP_FAILED) {
+		fprintf(stderr, "mmap %s failed: %s\n", name, strerror(errno));
+		sh->ring = NULL;
+		shm_unlink(name);
+		return RS_ERR;
 	}
-    active_touches++;
-
-	if (write_event(fd, EV_ABS, ABS_MT_SLOT, slot) == RS_ERR ||	
-		write_event(fd, EV_ABS, ABS_MT_TRACKING_ID, tid) == RS_ERR ||
-		write_event(fd, EV_ABS, ABS_MT_POSITION_X, x) == RS_ERR ||
-		write_event(fd, EV_ABS, ABS_MT_POSITION_Y, y) == RS_ERR ||
-		syn_mt(fd) == RS_ERR ||
-		syn(fd) == RS_ERR) {
+	sh->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (sh->efd < 0) {
+		fprintf(stderr, "eventfd failed: %s\n", strerror(errno));
+		munmap(sh->ring, sh->size);
+		sh->ring = NULL;
+		shm_unlink(name);
 		return RS_ERR;
 	}
+	sh->ring->size = SHM_RING_RECORDS;
+	/* magic 最后写，代理看到它即可开始使用 */
+	__atomic_store_n(&sh->ring->magic, MCA_SHM_MAGIC, __ATOMIC_RELEASE);
+	return RS_OK;
+}
 
-    return RS_OK;
+/**
+ * @brief 准备睡眠：置 waiting，再确认命令环为空
+ * @param sh 命令环状态
+ * @return 1 环中还有记录（waiting 已清除），0 可以睡眠
+ */
+static int shm_arm(struct serve_shm *sh) {
+	struct mca_shm_ring *r = sh->ring;
+
+	__atomic_store_n(&r->waiting, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == r->tail)
+		return 0;
+	__atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+	return 1;
 }
 
 /**
- * @brief 多点触控移动
- * @param fd 设备文件描述符
- * @param slot 触控点 slot 编号
- * @param lx UI 屏幕 X 坐标
- * @param ly UI 屏幕 Y 坐标
+ * @brief 执行命令环中已发布的全部记录
+ *
+ * 与网络请求共用 proto_exec()，连续的 MT_MOVE 同样合并为一帧。
+ * @param sh 命令环状态
+ */
+static void shm_drain(struct serve_shm *sh) {
+	struct mca_shm_ring *r = sh->ring;
+	struct proto_batch b;
+	uint32_t tail = r->tail;
+	uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+	/* 出错的生产者或上次运行遗留的段可能发布越界的 head，跳过而不是重放旧记录 */
+	if (head - tail > SHM_RING_RECORDS) {
+		if (!sh->corrupt)
+			fprintf(stderr, "shm: head %u is %u records ahead of tail %u, resynchronising\n",
+					head, head - tail, tail);
+		sh->corrupt = 1;
+		__atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+		return;
+	}
+
+	b.td = NULL;
+	b.n = 0;
+	for (; tail != head; tail++)
+		proto_exec(&r->rec[tail & (SHM_RING_RECORDS - 1)], &b);
+	proto_flush(&b);
+	__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 通过 SCM_RIGHTS 把 eventfd 交给客户端
+ * @param fd 客户端连接
+ * @param sh 命令环状态
  * @return RS_OK 成功，RS_ERR 失败
  */
-static int mt_move(int fd, int slot, int lx, int ly) {
-    if (slot < 0 || slot >= MAX_SLOTS || slot_tracking[slot] == 0) 
-		return RS_ERR;
+static int shm_send_efd(int fd, const struct serve_shm *sh) {
+	char reply[] = "OK\n";
+	char ctl[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { reply, sizeof(reply) - 1 };
+	struct msghdr msg;
+
+	if (!sh->ring)
+		return write(fd, "ERR\n", 4) == 4 ? RS_OK : RS_ERR;
+	memset(&msg, 0, sizeof(msg));
+	memset(ctl, 0, sizeof(ctl));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl;
+	msg.msg_controllen = sizeof(ctl);
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &sh->efd, sizeof(int));
+	return sendmsg(fd, &msg, 0) < 0 ? RS_ERR : RS_OK;
+}
 
-    int x = map_x(fd, lx);
-	int y = map_y(fd, ly);
+/**
+ * @brief 处理客户端可读事件，执行收到的完整命令行
+ * @param td 触摸设备
+ * @param c 客户端
+ * @param sh 共享内存命令环（回复 shm-eventfd）
+ * @param a 解析用的分配区
+ * @return RS_OK 连接保持，RS_ERR 连接应关闭
+ */
+static int serve_client_read(struct touch_dev *td, struct serve_client *c,
+							 const struct serve_shm *sh, struct arena *a) {
+	ssize_t n = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN))
+		return RS_OK;
+	if (n <= 0)
+		return RS_ERR;
+	c->len += n;
 
-	if (write_event(fd, EV_ABS, ABS_MT_SLOT, slot) == RS_ERR ||	
-		write_event(fd, EV_ABS, ABS_MT_POSITION_X, x) == RS_ERR ||
-		write_event(fd, EV_ABS, ABS_MT_POSITION_Y, y) == RS_ERR ||
-		syn_mt(fd) == RS_ERR ||
-		syn(fd) == RS_ERR) {
+	char *start = c->buf;
+	char *nl;
+	while ((nl = memchr(start, '\n', c->buf + c->len - start)) != NULL) {
+		*nl = '\0';
+		if (strncmp(start, "shm-eventfd", 11) == 0 && (start[11] == '\0' || start[11] == '\r')) {
+			/* 交出命令环的 eventfd */
+			if (shm_send_efd(c->fd, sh) == RS_ERR)
+				return RS_ERR;
+			start = nl + 1;
+			continue;
+		}
+		const char *reply = run_line(td, a, start) == RS_OK ? "OK\n" : "ERR\n";
+		if (write(c->fd, reply, strlen(reply)) < 0)
+			return RS_ERR;
+		start = nl + 1;
+	}
+	c->len -= start - c->buf;
+	memmove(c->buf, start, c->len);
+	if (c->len == (int)sizeof(c->buf) - 1) {
+		fprintf(stderr, "serve: line too long, dropping client\n");
 		return RS_ERR;
 	}
-
-    return RS_OK;
+	return RS_OK;
 }
 
 /**
- * @brief 多点触控抬起
- * @param fd 设备文件描述符
- * @param slot 触控点 slot 编号
- * @return RS_OK 成功，RS_ERR 失败
+ * @brief 守护模式主循环
+ * @param td 已打开的触摸设备（文本命令的默认设备）
+ * @param naddr 监听地址个数
+ * @param addrs 监听地址：Unix 域套接字路径、tcp:[HOST:]PORT 或 udp:[HOST:]PORT
+ * @return RS_OK 正常退出，RS_ERR 失败
  */
-static int mt_up(int fd, int slot) {
-	if (slot < 0 || slot >= MAX_SLOTS || slot_tracking[slot] == 0 ||
-		write_event(fd, EV_ABS, ABS_MT_SLOT, slot) == RS_ERR ||	
-		write_event(fd, EV_ABS, ABS_MT_TRACKING_ID, -1) == RS_ERR ||
-		syn_mt(fd) == RS_ERR ||
-		syn(fd) == RS_ERR) {
+static int serve(struct touch_dev *td, int naddr, char **addrs) {
+	struct serve_listener ls[SERVE_LISTENERS];
+	struct serve_client clients[SERVE_CLIENTS];
+	struct pollfd pfd[SERVE_LISTENERS + SERVE_CLIENTS + 1];
+	struct serve_shm sh = { NULL, 0, -1, 0 };
+	static struct arena arena;
+	char dgram[LINE_MAX_LEN];
+	int nls = 0;
+	int ret = RS_OK;
+
+	if (naddr > SERVE_LISTENERS) {
+		fprintf(stderr, "serve: at most %d addresses\n", SERVE_LISTENERS);
 		return RS_ERR;
 	}
+	for (int i = 0; i < naddr; i++) {
+		ls[nls].path = NULL;
+		if (strncmp(addrs[i], "tcp:", 4) == 0) {
+			ls[nls].kind = SERVE_TCP;
+			ls[nls].fd = serve_listen_inet(addrs[i] + 4, SOCK_STREAM);
+		}
+		else if (strncmp(addrs[i], "udp:", 4) == 0) {
+			ls[nls].kind = SERVE_UDP;
+			ls[nls].fd = serve_listen_inet(addrs[i] + 4, SOCK_DGRAM);
+		}
+		else {
+			ls[nls].kind = SERVE_UNIX;
+			ls[nls].path = addrs[i];
+			ls[nls].fd = serve_listen(addrs[i]);
+		}
+		if (ls[nls].fd == RS_ERR) {
+			ret = RS_ERR;
+			goto out;
+		}
+		nls++;
+	}
+	if (shm_name && shm_open_ring(&sh, shm_name) == RS_ERR) {
+		ret = RS_ERR;
+		goto out;
+	}
 
-    slot_tracking[slot] = 0;
-    if (--active_touches <= 0) {
-        active_touches = 0;
-        if (btn_touch_set(fd, 0) == RS_ERR) 
-			return RS_ERR;
-    }
+	install_stop_handlers();
+	signal(SIGPIPE, SIG_IGN);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_dump_signal;
+	sigaction(SIGUSR1, &sa, NULL);
 
-    return RS_OK;
+	for (int i = 0; i < SERVE_CLIENTS; i++)
+		clients[i].fd = -1;
+
+	while (!stop_flag) {
+		if (dump_flag) {
+			dump_flag = 0;
+			stats_dump(stderr);
+		}
+		for (int i = 0; i < nls; i++) {
+			pfd[i].fd = ls[i].fd;
+			pfd[i].events = POLLIN;
+		}
+		for (int i = 0; i < SERVE_CLIENTS; i++) {
+			pfd[nls + i].fd = clients[i].fd;
+			pfd[nls + i].events = POLLIN;
+		}
+		/* 命令环非空时不睡眠，只检查一下套接字 */
+		pfd[nls + SERVE_CLIENTS].fd = sh.efd;
+		pfd[nls + SERVE_CLIENTS].events = POLLIN;
+		int timeout = sh.ring && shm_arm(&sh) ? 0 : -1;
+		if (poll(pfd, nls + SERVE_CLIENTS + 1, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "poll failed: %s\n", strerror(errno));
+			break;
+		}
+		if (sh.ring) {
+			uint64_t v;
+			__atomic_store_n(&sh.ring->waiting, 0, __ATOMIC_RELAXED);
+			if (pfd[nls + SERVE_CLIENTS].revents & POLLIN)
+				while (read(sh.efd, &v, sizeof(v)) < 0 && errno == EINTR)
+					;
+			shm_drain(&sh);
+		}
+
+		for (int i = 0; i < SERVE_CLIENTS; i++) {
+			struct serve_client *c = &clients[i];
+			if (c->fd < 0 || !(pfd[nls + i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			if ((c->kind == SERVE_TCP ? serve_proto_read(c) :
+				 serve_client_read(td, c, &sh, &arena)) == RS_ERR) {
+				close(c->fd);
+				c->fd = -1;
+			}
+		}
+
+		for (int l = 0; l < nls; l++) {
+			if (!(pfd[l].revents & POLLIN))
+				continue;
+			if (ls[l].kind == SERVE_UDP) {
+				/* 一个数据报内的请求作为一批执行，不回复 */
+				struct mca_ack ack;
+				ssize_t n = recv(ls[l].fd, dgram, sizeof(dgram), 0);
+				if (n > 0)
+					proto_run(dgram, (int)n, &ack);
+				continue;
+			}
+
+			int cfd = accept(ls[l].fd, NULL, NULL);
+			int i;
+			if (cfd < 0)
+				continue;
+			for (i = 0; i < SERVE_CLIENTS && clients[i].fd >= 0; i++)
+				;
+			if (i == SERVE_CLIENTS) {
+				close(cfd);
+				continue;
+			}
+			if (ls[l].kind == SERVE_TCP) {
+				/* ack 很小，不等 Nagle 合并 */
+				int one = 1;
+				setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			}
+			clients[i].fd = cfd;
+			clients[i].kind = ls[l].kind;
+			clients[i].len = 0;
+		}
+	}
+
+	for (int i = 0; i < SERVE_CLIENTS; i++) {
+		if (clients[i].fd >= 0)
+			close(clients[i].fd);
+	}
+out:
+	for (int i = 0; i < nls; i++) {
+		close(ls[i].fd);
+		if (ls[i].path)
+			unlink(ls[i].path);
+	}
+	if (sh.ring) {
+		close(sh.efd);
+		munmap(sh.ring, sh.size);
+		shm_unlink(shm_name);
+	}
+	return ret;
 }
-#endif
 
 /* ------------------ 主函数 ------------------ */
 
@@ -396,23 +5338,100 @@ static int mt_up(int fd, int slot) {
  */
 static void usage(const char *p) {
     fprintf(stderr,
-        "Usage: %s [-d device] [--grab] [--map W H] <command> ...\n"
-        "Commands:\n"
+        "Usage: %s [-d [NAME=]device ...] [--grab] [--uinput] [--map W H] [--spin US]\n"
+        "          [--rate HZ] [--slots N] [--no-delta] [--speed F] [--stats]\n"
+        "          [--trace-json FILE] [--clock C] [--rt-prio N] [--cpu N]\n"
+        "          [--mlock] [--shm NAME] [--report] [--profile FILE] <command> ...\n"
+        "  -d [NAME=]PATH device to inject into; repeat for several panels, a\n"
+        "                 following --map applies to that device only; PATH may be\n"
+        "                 sock:SOCKET (forward raw events) or mem: (in-memory sink);\n"
+        "                 name:STR, phys:STR or mt:[STR] picks the first touch\n"
+        "                 device under /dev/input whose name/phys contains STR\n"
+        "  --uinput       inject into a new /dev/uinput touchscreen (axis ranges\n"
+        "                 copied from -d when given)\n"
+        "  --rate HZ      emit swipe frames at HZ instead of a fixed step count\n"
+        "  --slots N      override the MT slot count read from ABS_MT_SLOT\n"
+        "  --no-delta     always write every axis, even if unchanged (use when\n"
+        "                 real fingers may touch the panel during injection)\n"
+        "  --speed F      replay speed multiplier (0.01-100), 0 = as fast as possible\n"
+        "  --stats        print write/sleep/mapping counters on exit (SIGUSR1 in serve)\n"
+        "  --trace-json FILE   write recent write/sleep/gesture spans as Chrome trace\n"
+        "  --clock C      event timestamps: realtime (default), monotonic, or none\n"
+        "                 (one stamp per frame; the kernel restamps device writes)\n"
+        "  --rt-prio N    run under SCHED_FIFO priority N (1-99)\n"
+        "  --cpu N        pin the process to CPU N\n"
+        "  --mlock        lock all memory to avoid page faults while injecting\n"
+        "  --report       print per-gesture timing (duration error, frame jitter\n"
+        "                 min/p50/p99/max, missed frames, syscalls) to stderr\n"
+        "  --profile FILE cache discovered nodes and axis ranges by device identity\n"
+        "                 so later runs skip scanning and probing\n"
+        "  --shm NAME     serve also drains a shared-memory command ring (see\n"
+        "                 uinput_proto.h; eventfd via the 'shm-eventfd' line)\n"
+        "Commands (prefix @NAME or @all to pick devices, separate parallel\n"
+        "parts with '&'; parts start together on a shared deadline):\n"
         "  tap X Y [hold_ms]\n"
         "  press X Y\n"
         "  release\n"
         "  longpress X Y hold_ms\n"
-        "  swipe X1 Y1 X2 Y2 duration_ms [steps]\n"
+        "  swipe X1 Y1 X2 Y2 duration_ms [steps] [path]\n"
+        "      path: linear ease ease-in ease-out fling bezier[:CX:CY] circle[:DEG]\n"
+        "      (circle turns around X2,Y2 starting at X1,Y1)\n"
         "  mt-down SLOT X Y\n"
         "  mt-move SLOT X Y\n"
         "  mt-up SLOT\n"
+        "  mt-frame SLOT:X:Y [SLOT:X:Y ...]   (move several fingers in one frame)\n"
+        "  pinch CX CY R1 R2 duration_ms [steps] [fingers]\n"
+        "  rotate CX CY R DEG duration_ms [steps] [fingers]\n"
+        "  nswipe N X1 Y1 X2 Y2 duration_ms [steps] [spacing]\n"
+        "  stress SECONDS [rate_hz] [fingers] [seed]   (random taps, swipes and\n"
+        "                 drags for soak tests; 0 s = until SIGINT, seed printed)\n"
+        "  contact KEY=V[:V2] ...|off   (axes sent with later touches; V:V2 ramps\n"
+        "                 along swipes and gestures)\n"
+        "      p=0-100 (%% of pressure range) major=PX minor=PX orient=-90..90\n"
+        "      tool=finger|pen|palm|N\n"
+        "  sleep MS\n"
+        "  run FILE|-     (run a command script, one command per line)\n"
+        "  compile FILE|- OUT   (precompute a script into device-ready frames)\n"
+        "  play FILE      (write a compiled file with its deadlines)\n"
+        "  serve ADDR...  (daemon: a Unix socket path takes text commands line by\n"
+        "                 line, tcp:[HOST:]PORT and udp:[HOST:]PORT take the\n"
+        "                 binary protocol from uinput_proto.h)\n"
+        "  record FILE [seconds]   (capture real input into a binary trace)\n"
+        "  replay FILE    (replay a recorded trace with its original timing)\n"
+        "  latency [frames] [interval_ms]   (--uinput: loopback latency histogram)\n"
+#ifdef WITH_BENCH
+        "  bench [iterations]   (injection benchmark, JSON on stdout)\n"
+#endif
         "Examples:\n"
         "  %s -d /dev/input/event1 --map 800 480 tap 400 240\n"
         "  %s -d /dev/input/event1 --grab swipe 100 200 700 200 400 20\n"
-        "  %s -d /dev/input/event1 --map 800 480 mt-down 0 200 120\n",
-        p, p, p, p);
+        "  %s -d /dev/input/event1 --map 800 480 mt-down 0 200 120\n"
+        "  %s -d /dev/input/event1 --grab serve /tmp/mca_uinput.sock\n"
+        "  %s -d /dev/input/event1 --uinput serve /tmp/mca_uinput.sock\n"
+        "  %s -d a=/dev/input/event1 -d b=/dev/input/event2 \\\n"
+        "      @a swipe 1800 200 1919 200 300 '&' @b swipe 0 200 120 200 300\n",
+        p, p, p, p, p, p, p);
 }
 
+/** 仅有长格式的选项 */
+enum {
+	OPT_MAP = 0x100,	/* --map W H */
+	OPT_SPIN,			/* --spin US */
+	OPT_RATE,			/* --rate HZ */
+	OPT_SLOTS,			/* --slots N */
+	OPT_NO_DELTA,		/* --no-delta */
+	OPT_SPEED,			/* --speed F */
+	OPT_STATS,			/* --stats */
+	OPT_TRACE_JSON,		/* --trace-json FILE */
+	OPT_CLOCK,			/* --clock realtime|monotonic|none */
+	OPT_RT_PRIO,		/* --rt-prio N */
+	OPT_CPU,			/* --cpu N */
+	OPT_MLOCK,			/* --mlock */
+	OPT_SHM,			/* --shm NAME */
+	OPT_REPORT,			/* --report */
+	OPT_PROFILE,		/* --profile FILE */
+};
+
 /**
  * @brief 主函数
  * @param argc 参数数量
@@ -420,25 +5439,63 @@ static void usage(const char *p) {
  * @return RS_OK 成功，RS_ERR 失败
  */
 int main(int argc, char **argv) {
-	const char *dev = def_dev;
+	/* -d 给出的设备：名称、路径和各自的 --map 逻辑尺寸 */
+	const char *dev_name[DEVICES_MAX] = { NULL };
+	const char *dev_path_of[DEVICES_MAX] = { def_dev };
+	int dev_w[DEVICES_MAX], dev_h[DEVICES_MAX];
     int grab_flag = 0;
+    int uinput_flag = 0;
+    int dev_given = 0;
     int opt;
     struct option longopts[] = {
 		{"device", 1, NULL, 'd'},
 		{"grab", 0, NULL, 'g'},
-		{"map", 1, NULL, 0},
+		{"uinput", 0, NULL, 'u'},
+		{"map", 1, NULL, OPT_MAP},
+		{"spin", 1, NULL, OPT_SPIN},
+		{"rate", 1, NULL, OPT_RATE},
+		{"slots", 1, NULL, OPT_SLOTS},
+		{"no-delta", 0, NULL, OPT_NO_DELTA},
+		{"speed", 1, NULL, OPT_SPEED},
+		{"stats", 0, NULL, OPT_STATS},
+		{"trace-json", 1, NULL, OPT_TRACE_JSON},
+		{"clock", 1, NULL, OPT_CLOCK},
+		{"rt-prio", 1, NULL, OPT_RT_PRIO},
+		{"cpu", 1, NULL, OPT_CPU},
+		{"mlock", 0, NULL, OPT_MLOCK},
+		{"shm", 1, NULL, OPT_SHM},
+		{"report", 0, NULL, OPT_REPORT},
+		{"profile", 1, NULL, OPT_PROFILE},
 		{"help", 0, NULL, 'h'},
 		{"version", 0, NULL, 'v'},
 		{0, 0, 0, 0}
 	};
 	
-    while((opt = getopt_long(argc, argv, "d:ghv", longopts, NULL)) != -1) {
+	/* "+"：选项到命令名为止，命令里的负数参数（如 rotate 的 -90）不当作选项 */
+    while((opt = getopt_long(argc, argv, "+d:guhv", longopts, NULL)) != -1) {
         if(opt == 'd') {
-			dev = optarg;
+			/* -d [NAME=]PATH，可重复 */
+			if (dev_given == DEVICES_MAX) {
+				fprintf(stderr, "at most %d devices\n", DEVICES_MAX);
+				return RS_ERR;
+			}
+			char *eq = strchr(optarg, '=');
+			dev_name[dev_given] = NULL;
+			dev_path_of[dev_given] = optarg;
+			if (eq && !memchr(optarg, '/', eq - optarg)) {
+				*eq = '\0';
+				dev_name[dev_given] = optarg;
+				dev_path_of[dev_given] = eq + 1;
+			}
+			dev_w[dev_given] = dev_h[dev_given] = -1;
+			dev_given++;
 		}
         else if(opt == 'g') {
 			grab_flag = 1;
 		}
+		else if(opt == 'u') {
+			uinput_flag = 1;
+		}
 		else if(opt == 'h') {
 			usage(argv[0]);
 			return RS_OK;
@@ -447,11 +5504,92 @@ int main(int argc, char **argv) {
 			printf("uinput version %s\n", VERSION);
 			return RS_OK;
 		}
-        else if(opt == 0){ 
-			ui_w = atoi(optarg);
-			ui_h = atoi(argv[optind]);
+        else if(opt == OPT_MAP){ 
+			/* 跟在某个 -d 之后时只作用于该设备，否则作为默认值 */
+			if (optind >= argc) {
+				fprintf(stderr, "--map needs W H\n");
+				return RS_ERR;
+			}
+			int w, h;
+			if (opt_int("map", optarg, 0, COORD_LIMIT, &w) == RS_ERR ||
+				opt_int("map", argv[optind], 0, COORD_LIMIT, &h) == RS_ERR)
+				return RS_ERR;
+			if (dev_given > 0) {
+				dev_w[dev_given - 1] = w;
+				dev_h[dev_given - 1] = h;
+			}
+			else {
+				ui_w = w;
+				ui_h = h;
+			}
 			optind++;
 		}
+		else if(opt == OPT_SPIN) {
+			if (opt_int("spin", optarg, 0, 1000000, &spin_us) == RS_ERR)
+				return RS_ERR;
+		}
+		else if(opt == OPT_RATE) {
+			if (opt_int("rate", optarg, 0, RATE_MAX_HZ, &rate_hz) == RS_ERR)
+				return RS_ERR;
+		}
+		else if(opt == OPT_SLOTS) {
+			if (opt_int("slots", optarg, 0, SLOTS_LIMIT, &slots_opt) == RS_ERR)
+				return RS_ERR;
+		}
+		else if(opt == OPT_NO_DELTA) {
+			delta_opt = 0;
+		}
+		else if(opt == OPT_SPEED) {
+			char *end;
+			errno = 0;
+			speed = strtod(optarg, &end);
+			/* 0 表示尽快；非 0 倍率限制范围，换算截止时间时不会溢出 */
+			if (end == optarg || *end != '\0' || errno ||
+				!(speed == 0 || (speed >= SPEED_MIN && speed <= SPEED_MAX))) {
+				fprintf(stderr, "--speed: bad value '%s' (expected 0 or %g..%g)\n",
+						optarg, SPEED_MIN, SPEED_MAX);
+				return RS_ERR;
+			}
+		}
+		else if(opt == OPT_STATS) {
+			stats_opt = 1;
+		}
+		else if(opt == OPT_TRACE_JSON) {
+			span_path = optarg;
+		}
+		else if(opt == OPT_CLOCK) {
+			clock_set = 1;
+			if (strcmp(optarg, "realtime") == 0)
+				clock_opt = CLOCK_REALTIME;
+			else if (strcmp(optarg, "monotonic") == 0)
+				clock_opt = CLOCK_MONOTONIC;
+			else if (strcmp(optarg, "none") == 0)
+				clock_opt = -1;
+			else {
+				fprintf(stderr, "unknown clock: %s\n", optarg);
+				return RS_ERR;
+			}
+		}
+		else if(opt == OPT_RT_PRIO) {
+			if (opt_int("rt-prio", optarg, 0, 99, &rt_prio) == RS_ERR)
+				return RS_ERR;
+		}
+		else if(opt == OPT_CPU) {
+			if (opt_int("cpu", optarg, -1, CPU_SETSIZE - 1, &cpu_opt) == RS_ERR)
+				return RS_ERR;
+		}
+		else if(opt == OPT_MLOCK) {
+			mlock_opt = 1;
+		}
+		else if(opt == OPT_SHM) {
+			shm_name = optarg;
+		}
+		else if(opt == OPT_REPORT) {
+			report_opt = 1;
+		}
+		else if(opt == OPT_PROFILE) {
+			profile_path = optarg;
+		}
 		else {
 		}
     }
@@ -464,77 +5602,103 @@ int main(int argc, char **argv) {
 		return RS_ERR; 
 	}
 
-    int fd = open_dev(dev);
-    if(fd == RS_ERR) {
+    if(rt_setup() == RS_ERR) {
 		return RS_ERR;
 	}
 
-    if(grab_flag) {
-		ioctl(fd, EVIOCGRAB, 1);
+    /* 选择器先解析为节点路径，record 和 --uinput 复制轴范围时同样适用 */
+    static char dev_node[DEVICES_MAX][PATH_MAX];
+    for(int i = 0; i < (dev_given > 0 ? dev_given : 1); i++) {
+		if (!is_selector(dev_path_of[i]))
+			continue;
+		if (dev_resolve(dev_path_of[i], dev_node[i], sizeof(dev_node[i])) == RS_ERR)
+			return RS_ERR;
+		dev_path_of[i] = dev_node[i];
 	}
 
-    const char *cmd = argv[optind];
-    int ret = RS_OK;
+    if(strcmp(argv[optind], "record") == 0) {
+		/* 录制：只读打开设备，不进入注入路径 */
+		int seconds;
+		if (!need_args(argc - optind, argv + optind, 1) ||
+			arg_opt(argc - optind, argv + optind, 2, 0, INT_MAX, 0, &seconds) == RS_ERR)
+			return RS_ERR;
+		return record(dev_path_of[0], argv[optind+1], seconds, grab_flag);
+	}
 
-    if(strcmp(cmd, "tap") == 0) {
-		/* 单点触控 */
-        int x = atoi(argv[optind+1]);
-		int y = atoi(argv[optind+2]);
-        int hold = optind+3 < argc ? atoi(argv[optind+3]) : 100;
-        ret = do_tap(fd, x, y, hold);
-    }
-	else if(strcmp(cmd, "press") == 0) {
-		/* 按下 */
-		int x = atoi(argv[optind+1]);
-		int y = atoi(argv[optind+2]);
-		ret = do_press(fd, x, y);
-	}
-	else if(strcmp(cmd, "release") == 0) {
-		/* 抬起 */
-		ret = do_release(fd);
-	}
-	else if(strcmp(cmd, "longpress") == 0) {
-		/* 长按 */
-        int x = atoi(argv[optind+1]);
-		int y = atoi(argv[optind+2]);
-		int ms = atoi(argv[optind+3]);
-        ret = do_longpress(fd, x, y, ms);
-    } 
-	else if(strcmp(cmd, "swipe") == 0) {
-		/* 滑动 */
-        int x1 = atoi(argv[optind+1]);
-		int y1 = atoi(argv[optind+2]);
-        int x2 = atoi(argv[optind+3]);
-		int y2 = atoi(argv[optind+4]);
-        int ms = atoi(argv[optind+5]);
-        int steps = optind+6 < argc ? atoi(argv[optind+6]) : 20;
-        ret = do_swipe(fd, x1, y1, x2, y2, ms, steps);
-    } 
-#if MAX_SLOTS > 1
-	else if(strcmp(cmd, "mt-down") == 0) {
-		/* 多点触控 */
-        int slot = atoi(argv[optind+1]);
-        int x = atoi(argv[optind+2]);
-		int y = atoi(argv[optind+3]);
-        ret = mt_down(fd, slot, x, y);
-    } 
-	else if(strcmp(cmd, "mt-move") == 0) {
-		/* 多点触控移动 */
-        int slot = atoi(argv[optind+1]);
-        int x = atoi(argv[optind+2]);
-		int y = atoi(argv[optind+3]);
-        ret = mt_move(fd, slot, x, y);
-    } 
-	else if(strcmp(cmd, "mt-up") == 0) {
-		/* 多点触控抬起 */
-        int slot = atoi(argv[optind+1]);
-        ret = mt_up(fd, slot);
-    } 
-#endif
+    if(span_path) {
+		span_ring = malloc(sizeof(*span_ring) * SPAN_RING);
+		if (!span_ring) {
+			fprintf(stderr, "out of memory\n");
+			return RS_ERR;
+		}
+	}
+    if(report_alloc() == RS_ERR) {
+		return RS_ERR;
+	}
+
+    static struct touch_dev devs[DEVICES_MAX];
+    int ndev = dev_given > 0 ? dev_given : 1;
+    int def_w = ui_w, def_h = ui_h;
+    for(int i = 0; i < ndev; i++) {
+		/* ui_w/ui_h 是正在打开的设备使用的逻辑尺寸 */
+		ui_w = dev_given && dev_w[i] >= 0 ? dev_w[i] : def_w;
+		ui_h = dev_given && dev_h[i] >= 0 ? dev_h[i] : def_h;
+		if(uinput_flag ? open_uinput(&devs[i], dev_given ? dev_path_of[i] : NULL) == RS_ERR :
+			open_dev(&devs[i], dev_path_of[i]) == RS_ERR) {
+			while (i-- > 0)
+				close_dev(&devs[i]);
+			return RS_ERR;
+		}
+		if (dev_name[i])
+			snprintf(devs[i].name, sizeof(devs[i].name), "%s", dev_name[i]);
+		else
+			snprintf(devs[i].name, sizeof(devs[i].name), "%d", i);
+		if(grab_flag && !devs[i].is_uinput) {
+			dev_ioctl(devs[i].fd, EVIOCGRAB, 1);
+		}
+	}
+    dev_table = devs;
+    dev_count = ndev;
+
+    /* 各模式和不带 @NAME 的命令使用第一个设备 */
+    struct touch_dev *td = &devs[0];
+    int ret;
+    if(strcmp(argv[optind], "serve") == 0) {
+		/* 守护模式 */
+		ret = need_args(argc - optind, argv + optind, 1) ?
+			serve(td, argc - optind - 1, argv + optind + 1) : RS_ERR;
+	}
+	else if(strcmp(argv[optind], "latency") == 0) {
+		/* 回环延迟测量 */
+		int frames, interval;
+		ret = arg_opt(argc - optind, argv + optind, 1, 1, INT_MAX, LATENCY_FRAMES, &frames) == RS_OK &&
+			arg_opt(argc - optind, argv + optind, 2, 1, DURATION_MAX_MS, LATENCY_INTERVAL_MS,
+					&interval) == RS_OK ?
+			latency(td, frames, interval * 1000, grab_flag) : RS_ERR;
+	}
+	else if(strcmp(argv[optind], "compile") == 0) {
+		/* 编译脚本 */
+		ret = need_args(argc - optind, argv + optind, 2) ?
+			compile(td, argv[optind+1], argv[optind+2]) : RS_ERR;
+	}
+	else if(strcmp(argv[optind], "run") == 0) {
+		/* 脚本模式 */
+		ret = need_args(argc - optind, argv + optind, 1) ?
+			run_script(td, argv[optind+1]) : RS_ERR;
+	}
 	else {
-		/* 其他命令 */
-		usage(argv[0]);
+		static struct arena arena;
+		ret = route_cmd(td, &arena, argc - optind, argv + optind);
+	}
+    for(int i = 0; i < ndev; i++) {
+		close_dev(&devs[i]);
+	}
+    if(stats_opt) {
+		stats_dump(stderr);
+	}
+    if(span_dump() == RS_ERR) {
+		ret = RS_ERR;
 	}
-    close(fd);
+    free(span_ring);
     return ret;
 }
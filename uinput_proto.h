@@ -0,0 +1,82 @@
+/**
+ * @file uinput_proto.h
+ * @brief mca_uinput 守护模式的二进制请求协议
+ *
+ * serve 的 tcp:/udp: 监听地址使用本协议，远端控制程序可直接包含此头文件。
+ * 每个请求是定长的 struct mca_req，所有多字节字段为小端序。
+ *
+ *  - TCP：请求可以连续发送（流水线），服务端每处理完一次 read() 收到的
+ *    全部完整请求回复一个 struct mca_ack，确认到其中最后一个请求的 seq。
+ *  - UDP：一个数据报携带一个或多个请求，不回复，适合实时转发手指位置。
+ *
+ * 同一批中连续的 MCA_OP_MT_MOVE 合并为一帧写出（同一 slot 重复出现时先
+ * 提交之前的部分），主机端按采样率发送位置即可得到逐帧的多点轨迹。
+ */
+
+#ifndef UINPUT_PROTO_H
+#define UINPUT_PROTO_H
+
+#include <stdint.h>
+
+#define MCA_OP_TAP		1	/* 点击：x, y, ms = 按住时间 */
+#define MCA_OP_PRESS	2	/* 按下：x, y */
+#define MCA_OP_RELEASE	3	/* 抬起 */
+#define MCA_OP_SWIPE	4	/* 滑动：x, y 到 x2, y2，ms = 时长，steps = 步数（0 为默认） */
+#define MCA_OP_MT_DOWN	5	/* 多点按下：slot, x, y */
+#define MCA_OP_MT_MOVE	6	/* 多点移动：slot, x, y */
+#define MCA_OP_MT_UP	7	/* 多点抬起：slot */
+#define MCA_OP_SLEEP	8	/* 延迟：ms */
+
+/** 一个请求（20 字节，字段自然对齐） */
+struct mca_req {
+	uint8_t op;			/* MCA_OP_* */
+	uint8_t dev;		/* 目标设备在 -d 中的序号，0 为第一个 */
+	uint8_t slot;		/* 多点操作的 slot */
+	uint8_t steps;		/* 滑动步数，0 表示默认 */
+	uint16_t seq;		/* 请求序号，在 ack 中回显 */
+	int16_t x;			/* UI 坐标 X */
+	int16_t y;			/* UI 坐标 Y */
+	int16_t x2;			/* 终点 X（滑动） */
+	int16_t y2;			/* 终点 Y（滑动） */
+	uint16_t reserved;	/* 保留，填 0 */
+	uint32_t ms;		/* 时长或延迟（毫秒） */
+};
+
+/** TCP 批量确认（4 字节） */
+struct mca_ack {
+	uint16_t seq;		/* 本批最后一个请求的 seq */
+	uint16_t errors;	/* 本批失败的请求数 */
+};
+
+/*
+ * 共享内存命令环（serve --shm NAME）
+ *
+ * 守护进程用 shm_open(NAME) 创建 struct mca_shm_ring，单生产者（本地代理）
+ * 单消费者（守护进程），无锁。生产者：
+ *
+ *   1. 等待 head - tail < size（tail 用 acquire 读）
+ *   2. 填写 rec[head & (size - 1)]，然后以 release 语义写 head + 1
+ *   3. 一批写完后做一次全屏障，若 waiting 为 1，向 eventfd 写入 1
+ *
+ * 消费者准备睡眠前置 waiting = 1、全屏障、再检查 head，因此生产者在
+ * 消费者忙碌时不需要任何系统调用。eventfd 通过守护进程的 Unix 域套接字
+ * 取得：发送一行 "shm-eventfd"，回复 "OK" 并以 SCM_RIGHTS 附带描述符。
+ * head/tail 是只增不减的 32 位计数，回绕后取差值仍然正确。
+ */
+
+#define MCA_SHM_MAGIC	0x5341434dU	/* "MCAS" */
+
+/** 共享内存命令环，生产者和消费者各自写的字段位于不同的缓存行 */
+struct mca_shm_ring {
+	uint32_t magic;				/* MCA_SHM_MAGIC */
+	uint32_t size;				/* 记录数（2 的幂） */
+	uint8_t pad0[56];
+	uint32_t head;				/* 已发布的记录总数（生产者写） */
+	uint8_t pad1[60];
+	uint32_t tail;				/* 已执行的记录总数（消费者写） */
+	uint32_t waiting;			/* 消费者即将睡眠，需要 eventfd 唤醒（消费者写） */
+	uint8_t pad2[56];
+	struct mca_req rec[];		/* 记录 */
+};
+
+#endif /* UINPUT_PROTO_H */